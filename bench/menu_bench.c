@@ -0,0 +1,381 @@
+// Copyright (c) 2023 tsl0922. All rights reserved.
+// SPDX-License-Identifier: GPL-2.0-only
+
+// offline benchmark for the config parser and the dynamic menu builders:
+// feeds synthetic workloads through load_menu() / handle_init_menu() /
+// handle_menu() against stubbed Win32 menu calls and a stub mpv handle,
+// and reports ns/item over repeated runs
+//
+//     menu_bench [lines] [depth] [tracks] [repeats]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "misc/bstr.h"
+#include "menu.h"
+#include "plugin.h"
+
+// ---------------------------------------------------------------------------
+// Win32 menu stubs, see win32_stub.h
+
+typedef struct {
+    MENUITEMINFOW *items;
+    int num;
+} bench_menu;
+
+#define BENCH_MAX_MENUS 8192
+static bench_menu *all_menus[BENCH_MAX_MENUS];
+static int num_menus;
+static int64_t num_inserts;
+
+HMENU bench_CreatePopupMenu(void) {
+    bench_menu *menu = talloc_zero(NULL, bench_menu);
+    if (num_menus < BENCH_MAX_MENUS) all_menus[num_menus++] = menu;
+    return (HMENU)menu;
+}
+
+BOOL bench_DestroyMenu(HMENU hmenu) {
+    bench_menu *menu = (bench_menu *)hmenu;
+    for (int i = 0; i < menu->num; i++) {
+        if (menu->items[i].hSubMenu != NULL)
+            bench_DestroyMenu(menu->items[i].hSubMenu);
+    }
+    for (int i = 0; i < num_menus; i++) {
+        if (all_menus[i] == menu) all_menus[i] = NULL;
+    }
+    talloc_free(menu);
+    return TRUE;
+}
+
+BOOL bench_InsertMenuItemW(HMENU hmenu, UINT item, BOOL bypos,
+                           LPCMENUITEMINFOW mii) {
+    bench_menu *menu = (bench_menu *)hmenu;
+    MENUITEMINFOW copy = *mii;
+    if ((mii->fMask & MIIM_STRING) && mii->dwTypeData != NULL) {
+        copy.dwTypeData =
+            talloc_memdup(menu, mii->dwTypeData,
+                          (wcslen(mii->dwTypeData) + 1) * sizeof(wchar_t));
+    }
+    // the plugin only ever appends
+    MP_TARRAY_APPEND(menu, menu->items, menu->num, copy);
+    num_inserts++;
+    return TRUE;
+}
+
+// locate an item by position or command id, searching submenus like Win32
+static MENUITEMINFOW *bench_find(bench_menu *menu, UINT item, BOOL bypos) {
+    if (bypos) return (int)item < menu->num ? &menu->items[item] : NULL;
+
+    for (int i = 0; i < menu->num; i++) {
+        if (menu->items[i].wID == item) return &menu->items[i];
+        if (menu->items[i].hSubMenu != NULL) {
+            MENUITEMINFOW *ret =
+                bench_find((bench_menu *)menu->items[i].hSubMenu, item, bypos);
+            if (ret != NULL) return ret;
+        }
+    }
+    return NULL;
+}
+
+BOOL bench_SetMenuItemInfoW(HMENU hmenu, UINT item, BOOL bypos,
+                            LPCMENUITEMINFOW mii) {
+    MENUITEMINFOW *it = bench_find((bench_menu *)hmenu, item, bypos);
+    if (it == NULL) return FALSE;
+    if (mii->fMask & MIIM_STATE) it->fState = mii->fState;
+    if (mii->fMask & MIIM_DATA) it->dwItemData = mii->dwItemData;
+    return TRUE;
+}
+
+BOOL bench_GetMenuItemInfoW(HMENU hmenu, UINT item, BOOL bypos,
+                            LPMENUITEMINFOW mii) {
+    MENUITEMINFOW *it = bench_find((bench_menu *)hmenu, item, bypos);
+    if (it == NULL) return FALSE;
+    if (mii->fMask & MIIM_STATE) mii->fState = it->fState;
+    if (mii->fMask & MIIM_DATA) mii->dwItemData = it->dwItemData;
+    if (mii->fMask & MIIM_SUBMENU) mii->hSubMenu = it->hSubMenu;
+    if (mii->fMask & MIIM_FTYPE) mii->fType = it->fType;
+    if (mii->fMask & MIIM_STRING) {
+        wchar_t *title = it->dwTypeData;
+        UINT len = title != NULL ? wcslen(title) : 0;
+        if (mii->dwTypeData == NULL) {
+            mii->cch = len;
+        } else {
+            UINT n = mii->cch > 0 ? mii->cch - 1 : 0;
+            if (n > len) n = len;
+            memcpy(mii->dwTypeData, title, n * sizeof(wchar_t));
+            mii->dwTypeData[n] = L'\0';
+            mii->cch = n;
+        }
+    }
+    mii->wID = it->wID;
+    mii->hSubMenu = it->hSubMenu;
+    mii->fType = it->fType;
+    return TRUE;
+}
+
+int bench_GetMenuItemCount(HMENU hmenu) {
+    return ((bench_menu *)hmenu)->num;
+}
+
+BOOL bench_RemoveMenu(HMENU hmenu, UINT pos, UINT flags) {
+    bench_menu *menu = (bench_menu *)hmenu;
+    if (!(flags & MF_BYPOSITION) || (int)pos >= menu->num) return FALSE;
+    memmove(&menu->items[pos], &menu->items[pos + 1],
+            (menu->num - pos - 1) * sizeof(*menu->items));
+    menu->num--;
+    return TRUE;
+}
+
+BOOL bench_CheckMenuRadioItem(HMENU hmenu, UINT first, UINT last, UINT check,
+                              UINT flags) {
+    return TRUE;
+}
+
+BOOL bench_EnableMenuItem(HMENU hmenu, UINT item, UINT enable) {
+    return TRUE;
+}
+
+BOOL bench_TrackPopupMenuEx(HMENU hmenu, UINT flags, int x, int y, HWND hwnd,
+                            LPTPMPARAMS params) {
+    return TRUE;
+}
+
+// ---------------------------------------------------------------------------
+// mpv client / plugin helper stubs
+
+static char *bench_conf;  // synthetic config served as input-conf
+static int64_t num_commands;
+
+int mpv_observe_property(mpv_handle *mpv, uint64_t reply_userdata,
+                         const char *name, mpv_format format) {
+    return 0;
+}
+
+int mpv_get_property(mpv_handle *mpv, const char *name, mpv_format format,
+                     void *data) {
+    return -1;
+}
+
+char *mpv_get_property_string(mpv_handle *mpv, const char *name) {
+    return NULL;
+}
+
+int mpv_set_property(mpv_handle *mpv, const char *name, mpv_format format,
+                     void *data) {
+    return 0;
+}
+
+int mpv_command_async(mpv_handle *mpv, uint64_t reply_userdata,
+                      const char **args) {
+    num_commands++;
+    return 0;
+}
+
+void mpv_free(void *data) {}
+void mpv_free_node_contents(mpv_node *node) {}
+void mpv_wakeup(mpv_handle *mpv) {}
+
+wchar_t *mp_from_utf8(void *talloc_ctx, const char *s) {
+    int count = MultiByteToWideChar(CP_UTF8, 0, s, -1, NULL, 0);
+    if (count <= 0) abort();
+    wchar_t *ret = talloc_array(talloc_ctx, wchar_t, count);
+    MultiByteToWideChar(CP_UTF8, 0, s, -1, ret, count);
+    return ret;
+}
+
+wchar_t *mp_from_utf8_bstr(void *talloc_ctx, bstr s) {
+    if (s.len == 0) return talloc_zero_array(talloc_ctx, wchar_t, 1);
+    int count =
+        MultiByteToWideChar(CP_UTF8, 0, (char *)s.start, s.len, NULL, 0);
+    if (count <= 0) abort();
+    wchar_t *ret = talloc_array(talloc_ctx, wchar_t, count + 1);
+    MultiByteToWideChar(CP_UTF8, 0, (char *)s.start, s.len, ret, count);
+    ret[count] = L'\0';
+    return ret;
+}
+
+char *mp_to_utf8(void *talloc_ctx, const wchar_t *s) {
+    int count = WideCharToMultiByte(CP_UTF8, 0, s, -1, NULL, 0, NULL, NULL);
+    if (count <= 0) abort();
+    char *ret = talloc_array(talloc_ctx, char, count);
+    WideCharToMultiByte(CP_UTF8, 0, s, -1, ret, count, NULL, NULL);
+    return ret;
+}
+
+char *mp_expand_path(void *talloc_ctx, char *path) {
+    return talloc_strdup(talloc_ctx, path);
+}
+
+char *mp_get_prop_string(void *talloc_ctx, const char *prop) {
+    if (strcmp(prop, "input-conf") == 0)
+        return talloc_strdup(talloc_ctx, bench_conf);
+    return NULL;
+}
+
+char *mp_read_file(void *talloc_ctx, char *path) {
+    if (bstr_startswith0(bstr0(path), "memory://"))
+        return talloc_strdup(talloc_ctx, path + strlen("memory://"));
+    return NULL;
+}
+
+bool mp_map_file(mp_file_map *map, void *talloc_ctx, char *path) {
+    *map = (mp_file_map){.hfile = INVALID_HANDLE_VALUE};
+    if (!bstr_startswith0(bstr0(path), "memory://")) return false;
+    map->data = bstr0(talloc_strdup(talloc_ctx, path + strlen("memory://")));
+    return true;
+}
+
+void mp_unmap_file(mp_file_map *map) {
+    *map = (mp_file_map){.hfile = INVALID_HANDLE_VALUE};
+}
+
+void mp_command_async(const char *args) {
+    num_commands++;
+}
+
+// ---------------------------------------------------------------------------
+// workloads
+
+static uint64_t now_ns() {
+    static uint64_t freq;
+    if (freq == 0) {
+        LARGE_INTEGER li;
+        QueryPerformanceFrequency(&li);
+        freq = li.QuadPart;
+    }
+    LARGE_INTEGER li;
+    QueryPerformanceCounter(&li);
+    return li.QuadPart * UINT64_C(1000000000) / freq;
+}
+
+// an N-line config with the given nesting depth, served via memory://
+static char *make_config(void *talloc_ctx, int lines, int depth) {
+    bstr buf = bstr0(NULL);
+    bstr_xappend(talloc_ctx, &buf, bstr0("memory://"));
+    for (int i = 0; i < lines; i++) {
+        bstr_xappend(talloc_ctx, &buf, bstr0("_ ignore #menu: "));
+        for (int d = 0; d + 1 < depth; d++)
+            bstr_xappend_asprintf(talloc_ctx, &buf, "L%d-%d > ", d,
+                                  i % (d + 2));
+        bstr_xappend_asprintf(talloc_ctx, &buf, "Item &%d\n", i);
+    }
+    bstr_xappend(talloc_ctx, &buf,
+                 bstr0("_ ignore #menu: Tracks #@tracks/video\n"
+                       "_ ignore #menu: Chapters #@chapters\n"));
+    return (char *)buf.start;
+}
+
+static void make_track_list(mp_state *state, int m) {
+    if (state->track_list != NULL) talloc_free(state->track_list);
+    mp_track_list *list = talloc_zero(state, mp_track_list);
+
+    list->strings = talloc_size(list, m * 32);
+    size_t off = 0;
+    for (int i = 0; i < m; i++) {
+        int len = snprintf(list->strings + off, 32, "Track Title %d", i + 1);
+        mp_track_item item = {
+            .id = i + 1,
+            .type = mp_intern(state, "video"),
+            .title = {(unsigned char *)list->strings + off, len},
+            .selected = i == 0,
+        };
+        off += len;
+        MP_TARRAY_APPEND(list, list->entries, list->num_entries, item);
+    }
+
+    state->track_list = list;
+    state->track_gen.list++;
+}
+
+static void make_chapter_list(mp_state *state, int m) {
+    if (state->chapter_list != NULL) talloc_free(state->chapter_list);
+    mp_chapter_list *list = talloc_zero(state, mp_chapter_list);
+
+    list->strings = talloc_size(list, m * 32);
+    size_t off = 0;
+    for (int i = 0; i < m; i++) {
+        int len = snprintf(list->strings + off, 32, "Chapter %d", i + 1);
+        mp_chapter_item item = {
+            .title = {(unsigned char *)list->strings + off, len},
+            .time = i * 60.0,
+        };
+        off += len;
+        MP_TARRAY_APPEND(list, list->entries, list->num_entries, item);
+    }
+
+    state->chapter_list = list;
+    state->chapter_gen.list++;
+}
+
+// the dynamic submenu registered for keyword, via the stub menu registry
+static HMENU find_dyn_menu(const char *keyword) {
+    for (int i = 0; i < num_menus; i++) {
+        if (all_menus[i] == NULL) continue;
+        char *kw = dyn_menu_keyword((HMENU)all_menus[i]);
+        if (kw != NULL && strcmp(kw, keyword) == 0)
+            return (HMENU)all_menus[i];
+    }
+    return NULL;
+}
+
+static void report(const char *phase, uint64_t ns, int64_t items) {
+    printf("%-10s %10lld items  %8.1f ns/item\n", phase,
+           (long long)items, items > 0 ? (double)ns / items : 0.0);
+}
+
+int main(int argc, char **argv) {
+    int lines = argc > 1 ? atoi(argv[1]) : 1000;
+    int depth = argc > 2 ? atoi(argv[2]) : 4;
+    int tracks = argc > 3 ? atoi(argv[3]) : 64;
+    int repeats = argc > 4 ? atoi(argv[4]) : 50;
+    int chapters = 1000;
+
+    plugin_ctx *ctx = talloc_zero(NULL, plugin_ctx);
+    ctx->conf = talloc_zero(ctx, plugin_config);
+    ctx->state = talloc_zero(ctx, mp_state);
+
+    bench_conf = make_config(ctx, lines, depth);
+
+    // parse: config tokenizing + tree building
+    uint64_t t0 = now_ns();
+    for (int r = 0; r < repeats; r++) {
+        num_inserts = 0;
+        HMENU hmenu = load_menu(ctx);
+        if (r + 1 < repeats) DestroyMenu(hmenu);
+    }
+    uint64_t parse_ns = now_ns() - t0;
+    report("parse", parse_ns / repeats, num_inserts);
+
+    // tracks: provider rebuild of an M-entry track submenu
+    HMENU track_menu = find_dyn_menu("tracks/video");
+    make_track_list(ctx->state, tracks);
+    t0 = now_ns();
+    for (int r = 0; r < repeats; r++) {
+        ctx->state->track_gen.list++;  // force a full rebuild
+        handle_init_menu(ctx, track_menu);
+    }
+    report("tracks", (now_ns() - t0) / repeats, tracks);
+
+    // chapters: provider rebuild of a 1000-chapter submenu
+    HMENU chapter_menu = find_dyn_menu("chapters");
+    make_chapter_list(ctx->state, chapters);
+    t0 = now_ns();
+    for (int r = 0; r < repeats; r++) {
+        ctx->state->chapter_gen.list++;
+        handle_init_menu(ctx, chapter_menu);
+    }
+    report("chapters", (now_ns() - t0) / repeats, chapters);
+
+    // click: command lookup and dispatch per activation
+    ctx->hmenu = chapter_menu;
+    bench_menu *cm = (bench_menu *)chapter_menu;
+    t0 = now_ns();
+    num_commands = 0;
+    for (int r = 0; r < repeats; r++) {
+        for (int i = 0; i < cm->num; i++) handle_menu(ctx, cm->items[i].wID);
+    }
+    uint64_t click_ns = now_ns() - t0;
+    report("click", click_ns / repeats, num_commands / repeats);
+
+    return 0;
+}
@@ -0,0 +1,40 @@
+// Copyright (c) 2023 tsl0922. All rights reserved.
+// SPDX-License-Identifier: GPL-2.0-only
+
+// force-included into every menu_bench translation unit: reroutes the
+// Win32 menu calls to in-process stubs (bench/menu_bench.c), so the
+// parser and menu builders run without a window or USER objects
+
+#ifndef MENU_BENCH_WIN32_STUB_H
+#define MENU_BENCH_WIN32_STUB_H
+
+#include <windows.h>
+
+HMENU bench_CreatePopupMenu(void);
+BOOL bench_DestroyMenu(HMENU hmenu);
+BOOL bench_InsertMenuItemW(HMENU hmenu, UINT item, BOOL bypos,
+                           LPCMENUITEMINFOW mii);
+BOOL bench_SetMenuItemInfoW(HMENU hmenu, UINT item, BOOL bypos,
+                            LPCMENUITEMINFOW mii);
+BOOL bench_GetMenuItemInfoW(HMENU hmenu, UINT item, BOOL bypos,
+                            LPMENUITEMINFOW mii);
+int bench_GetMenuItemCount(HMENU hmenu);
+BOOL bench_RemoveMenu(HMENU hmenu, UINT pos, UINT flags);
+BOOL bench_CheckMenuRadioItem(HMENU hmenu, UINT first, UINT last, UINT check,
+                              UINT flags);
+BOOL bench_EnableMenuItem(HMENU hmenu, UINT item, UINT enable);
+BOOL bench_TrackPopupMenuEx(HMENU hmenu, UINT flags, int x, int y, HWND hwnd,
+                            LPTPMPARAMS params);
+
+#define CreatePopupMenu bench_CreatePopupMenu
+#define DestroyMenu bench_DestroyMenu
+#define InsertMenuItemW bench_InsertMenuItemW
+#define SetMenuItemInfoW bench_SetMenuItemInfoW
+#define GetMenuItemInfoW bench_GetMenuItemInfoW
+#define GetMenuItemCount bench_GetMenuItemCount
+#define RemoveMenu bench_RemoveMenu
+#define CheckMenuRadioItem bench_CheckMenuRadioItem
+#define EnableMenuItem bench_EnableMenuItem
+#define TrackPopupMenuEx bench_TrackPopupMenuEx
+
+#endif
@@ -207,6 +207,32 @@ size_t ta_get_size(void *ptr)
     return h ? h->size : 0;
 }
 
+static size_t total_size_children(struct ta_header *h, size_t *num_allocs)
+{
+    size_t size = 0;
+    for (; h; h = h->next) {
+        size += h->size + total_size_children(h->child, num_allocs);
+        if (num_allocs)
+            *num_allocs += 1;
+    }
+    return size;
+}
+
+/* Return the total size of the allocation and all of its direct and indirect
+ * children. If num_allocs is not NULL, it is incremented by the number of
+ * allocations visited (including ptr itself).
+ * If ptr==NULL, return 0.
+ */
+size_t ta_total_size(void *ptr, size_t *num_allocs)
+{
+    struct ta_header *h = get_header(ptr);
+    if (!h)
+        return 0;
+    if (num_allocs)
+        *num_allocs += 1;
+    return h->size + total_size_children(h->child, num_allocs);
+}
+
 /* Free all allocations that (recursively) have ptr as parent allocation, but
  * do not free ptr itself.
  */
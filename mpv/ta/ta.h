@@ -48,6 +48,7 @@ void *ta_alloc_size(void *ta_parent, size_t size);
 void *ta_zalloc_size(void *ta_parent, size_t size);
 void *ta_realloc_size(void *ta_parent, void *ptr, size_t size);
 size_t ta_get_size(void *ptr);
+size_t ta_total_size(void *ptr, size_t *num_allocs);
 void ta_free(void *ptr);
 void ta_free_children(void *ptr);
 void ta_set_destructor(void *ptr, void (*destructor)(void *));
@@ -42,6 +42,7 @@
 #define talloc_size                     ta_xalloc_size
 #define talloc_zero_size                ta_xzalloc_size
 #define talloc_get_size                 ta_get_size
+#define talloc_total_size               ta_total_size
 #define talloc_free_children            ta_free_children
 #define talloc_free                     ta_free
 #define talloc_dup                      ta_xdup
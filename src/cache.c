@@ -0,0 +1,351 @@
+// Copyright (c) 2023 tsl0922. All rights reserved.
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include "misc/bstr.h"
+#include "menu.h"
+#include "cache.h"
+
+// compiled menu cache: the parsed menu tree is serialized to a flat binary
+// file after the first successful parse, keyed by the input.conf path, size
+// and mtime, so later startups skip tokenization entirely and build the
+// HMENU tree from a single sequential read
+
+#define MENU_CACHE_PATH "~~/cache/menu.bin"
+#define MENU_CACHE_DIR "~~/cache"
+
+#define MENU_CACHE_MAGIC 0x756e656d  // "menu"
+// v2: unbound #@ keywords are serialized too, older blobs dropped them
+#define MENU_CACHE_VERSION 2
+
+enum {
+    MENU_REC_ITEM,       // leaf item
+    MENU_REC_SEPARATOR,  // separator item
+    MENU_REC_SUBMENU,    // submenu item, children follow
+    MENU_REC_END,        // end of a submenu's children
+};
+
+typedef struct {
+    uint32_t magic;      // MENU_CACHE_MAGIC
+    uint32_t version;    // MENU_CACHE_VERSION
+    uint64_t conf_size;  // source file size
+    uint64_t conf_mtime;  // source file mtime
+    uint32_t path_len;    // source path length (bytes), path follows
+} menu_cache_header;
+
+typedef struct {
+    uint32_t type;       // MENU_REC_*
+    uint32_t state;      // menu item fState
+    uint32_t title_len;  // title length (wchars), title follows
+    uint32_t cmd_len;    // command length (bytes), command follows
+    uint32_t dyn_len;    // provider keyword length (bytes), keyword follows
+} menu_cache_record;
+
+static bool cache_stat(char *path, uint64_t *size, uint64_t *mtime) {
+    void *tmp = talloc_new(NULL);
+    wchar_t *path_w = mp_from_utf8(tmp, mp_expand_path(tmp, path));
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    bool ok = GetFileAttributesExW(path_w, GetFileExInfoStandard, &attr);
+    talloc_free(tmp);
+    if (!ok) return false;
+
+    *size = ((uint64_t)attr.nFileSizeHigh << 32) | attr.nFileSizeLow;
+    *mtime = ((uint64_t)attr.ftLastWriteTime.dwHighDateTime << 32) |
+             attr.ftLastWriteTime.dwLowDateTime;
+    return true;
+}
+
+static bool serialize_menu(void *tmp, bstr *blob, HMENU hmenu) {
+    int count = GetMenuItemCount(hmenu);
+    if (count < 0) return false;
+
+    for (int i = 0; i < count; i++) {
+        MENUITEMINFOW mii = {0};
+        mii.cbSize = sizeof(mii);
+        mii.fMask = MIIM_FTYPE | MIIM_STATE | MIIM_STRING | MIIM_SUBMENU |
+                    MIIM_DATA;
+        if (!GetMenuItemInfoW(hmenu, i, TRUE, &mii)) return false;
+
+        wchar_t *title = NULL;
+        if (mii.cch > 0) {
+            MENUITEMINFOW tii = {0};
+            tii.cbSize = sizeof(tii);
+            tii.fMask = MIIM_STRING;
+            tii.cch = mii.cch + 1;
+            title = talloc_array(tmp, wchar_t, tii.cch);
+            tii.dwTypeData = title;
+            if (!GetMenuItemInfoW(hmenu, i, TRUE, &tii)) return false;
+        }
+
+        menu_cmd *item_cmd = mii.hSubMenu ? NULL : (menu_cmd *)mii.dwItemData;
+        char *cmd = item_cmd != NULL ? item_cmd->text : NULL;
+        char *keyword = mii.hSubMenu ? dyn_menu_keyword(mii.hSubMenu) : NULL;
+
+        menu_cache_record rec = {0};
+        if (mii.fType & MFT_SEPARATOR) {
+            rec.type = MENU_REC_SEPARATOR;
+        } else if (mii.hSubMenu != NULL) {
+            rec.type = MENU_REC_SUBMENU;
+        } else {
+            rec.type = MENU_REC_ITEM;
+        }
+        rec.state = mii.fState;
+        rec.title_len = title ? wcslen(title) : 0;
+        rec.cmd_len = cmd ? strlen(cmd) : 0;
+        rec.dyn_len = keyword ? strlen(keyword) : 0;
+
+        bstr_xappend(tmp, blob, (bstr){(unsigned char *)&rec, sizeof(rec)});
+        if (rec.title_len > 0) {
+            bstr_xappend(tmp, blob,
+                         (bstr){(unsigned char *)title,
+                                rec.title_len * sizeof(wchar_t)});
+        }
+        if (rec.cmd_len > 0) bstr_xappend(tmp, blob, bstr0(cmd));
+        if (rec.dyn_len > 0) bstr_xappend(tmp, blob, bstr0(keyword));
+
+        if (mii.hSubMenu != NULL) {
+            if (!serialize_menu(tmp, blob, mii.hSubMenu)) return false;
+            menu_cache_record end = {.type = MENU_REC_END};
+            bstr_xappend(tmp, blob,
+                         (bstr){(unsigned char *)&end, sizeof(end)});
+        }
+    }
+    return true;
+}
+
+// replay records into hmenu until the submenu's end record (or end of blob
+// at top level), returns the position past the consumed records or NULL on
+// a malformed blob; commands and keywords are allocated under the current
+// menu generation so a reload frees them with the rest of the tables
+static const uint8_t *replay_menu(HMENU hmenu, const uint8_t *p,
+                                  const uint8_t *end) {
+    while (p < end) {
+        menu_cache_record rec;
+        if ((size_t)(end - p) < sizeof(rec)) return NULL;
+        memcpy(&rec, p, sizeof(rec));
+        p += sizeof(rec);
+
+        if (rec.type == MENU_REC_END) return p;
+
+        size_t payload =
+            rec.title_len * sizeof(wchar_t) + rec.cmd_len + rec.dyn_len;
+        if ((size_t)(end - p) < payload) return NULL;
+
+        wchar_t *title = talloc_array(NULL, wchar_t, rec.title_len + 1);
+        memcpy(title, p, rec.title_len * sizeof(wchar_t));
+        title[rec.title_len] = L'\0';
+        p += rec.title_len * sizeof(wchar_t);
+
+        char *cmd = NULL;
+        if (rec.cmd_len > 0)
+            cmd = talloc_strndup(menu_gen_ctx(), (const char *)p, rec.cmd_len);
+        p += rec.cmd_len;
+
+        bstr keyword = {(unsigned char *)p, rec.dyn_len};
+        p += rec.dyn_len;
+
+        switch (rec.type) {
+            case MENU_REC_SEPARATOR:
+                append_seprator(hmenu);
+                break;
+            case MENU_REC_ITEM:
+                append_menu(hmenu, MIIM_STRING | MIIM_DATA | MIIM_STATE, 0,
+                            rec.state, title, NULL,
+                            cmd != NULL ? menu_cmd_parse(menu_gen_ctx(), cmd)
+                                        : NULL);
+                break;
+            case MENU_REC_SUBMENU: {
+                HMENU submenu = CreatePopupMenu();
+                int id = append_menu(hmenu,
+                                     MIIM_STRING | MIIM_SUBMENU | MIIM_STATE,
+                                     0, rec.state, title, submenu, NULL);
+                if (id > 0 && keyword.len > 0)
+                    add_dyn_menu(menu_gen_ctx(), submenu, id, keyword);
+                p = replay_menu(submenu, p, end);
+                break;
+            }
+            default:
+                p = NULL;
+                break;
+        }
+
+        talloc_free(title);
+        if (p == NULL) return NULL;
+    }
+    return p;
+}
+
+HMENU menu_cache_load(plugin_ctx *ctx, char *path) {
+    if (bstr_startswith0(bstr0(path), "memory://")) return NULL;
+
+    uint64_t size, mtime;
+    if (!cache_stat(path, &size, &mtime)) return NULL;
+
+    void *tmp = talloc_new(NULL);
+    char *data = mp_read_file(tmp, MENU_CACHE_PATH);
+    HMENU hmenu = NULL;
+
+    if (data != NULL) {
+        // mp_read_file appends a NUL byte to the talloc array
+        size_t len = talloc_get_size(data) - 1;
+        menu_cache_header hdr;
+
+        if (len >= sizeof(hdr)) {
+            memcpy(&hdr, data, sizeof(hdr));
+            if (hdr.magic == MENU_CACHE_MAGIC &&
+                hdr.version == MENU_CACHE_VERSION &&
+                hdr.conf_size == size && hdr.conf_mtime == mtime &&
+                hdr.path_len == strlen(path) &&
+                len >= sizeof(hdr) + hdr.path_len &&
+                memcmp(data + sizeof(hdr), path, hdr.path_len) == 0) {
+                const uint8_t *p =
+                    (uint8_t *)data + sizeof(hdr) + hdr.path_len;
+                const uint8_t *end = (uint8_t *)data + len;
+
+                hmenu = CreatePopupMenu();
+                if (replay_menu(hmenu, p, end) != end) {
+                    DestroyMenu(hmenu);
+                    hmenu = NULL;
+                }
+            }
+        }
+    }
+
+    talloc_free(tmp);
+    return hmenu;
+}
+
+// opt-in shared mode for multi-instance deployments: the first instance
+// publishes the compiled blob in a named shared-memory section, later
+// instances map the pre-parsed records instead of re-parsing the config
+
+static wchar_t *shared_section_name(void *talloc_ctx, char *path) {
+    // key the section on the expanded source path
+    char *path_m = mp_expand_path(talloc_ctx, path);
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (char *s = path_m; *s; s++)
+        h = (h ^ (unsigned char)*s) * 0x100000001b3ULL;
+    return mp_from_utf8(
+        talloc_ctx, talloc_asprintf(talloc_ctx, "Local\\mpv-menu-%016llx",
+                                    (unsigned long long)h));
+}
+
+HMENU menu_shared_load(plugin_ctx *ctx, char *path) {
+    if (bstr_startswith0(bstr0(path), "memory://")) return NULL;
+
+    uint64_t size, mtime;
+    if (!cache_stat(path, &size, &mtime)) return NULL;
+
+    void *tmp = talloc_new(NULL);
+    HANDLE hmap = OpenFileMappingW(FILE_MAP_READ, FALSE,
+                                   shared_section_name(tmp, path));
+    if (hmap == NULL) {
+        talloc_free(tmp);
+        return NULL;
+    }
+
+    HMENU hmenu = NULL;
+    const uint8_t *view = MapViewOfFile(hmap, FILE_MAP_READ, 0, 0, 0);
+    if (view != NULL) {
+        MEMORY_BASIC_INFORMATION mbi;
+        uint64_t len = 0;
+        if (VirtualQuery(view, &mbi, sizeof(mbi)) == sizeof(mbi))
+            memcpy(&len, view, sizeof(len));
+        MemoryBarrier();  // pairs with the publisher's length store
+
+        menu_cache_header hdr;
+        if (len >= sizeof(hdr) && len <= mbi.RegionSize - sizeof(len)) {
+            const uint8_t *blob = view + sizeof(len);
+            memcpy(&hdr, blob, sizeof(hdr));
+            if (hdr.magic == MENU_CACHE_MAGIC &&
+                hdr.version == MENU_CACHE_VERSION &&
+                hdr.conf_size == size && hdr.conf_mtime == mtime &&
+                hdr.path_len == strlen(path) &&
+                len >= sizeof(hdr) + hdr.path_len &&
+                memcmp(blob + sizeof(hdr), path, hdr.path_len) == 0) {
+                const uint8_t *p = blob + sizeof(hdr) + hdr.path_len;
+                const uint8_t *end = blob + len;
+
+                hmenu = CreatePopupMenu();
+                if (replay_menu(hmenu, p, end) != end) {
+                    DestroyMenu(hmenu);
+                    hmenu = NULL;
+                }
+            }
+        }
+        UnmapViewOfFile((void *)view);
+    }
+
+    CloseHandle(hmap);
+    talloc_free(tmp);
+    return hmenu;
+}
+
+void menu_shared_publish(plugin_ctx *ctx, char *path, HMENU hmenu) {
+    if (ctx->hshared != NULL) return;  // already published
+    if (bstr_startswith0(bstr0(path), "memory://")) return;
+
+    menu_cache_header hdr = {MENU_CACHE_MAGIC, MENU_CACHE_VERSION};
+    if (!cache_stat(path, &hdr.conf_size, &hdr.conf_mtime)) return;
+    hdr.path_len = strlen(path);
+
+    void *tmp = talloc_new(NULL);
+    bstr blob = bstr0(NULL);
+    bstr_xappend(tmp, &blob, (bstr){(unsigned char *)&hdr, sizeof(hdr)});
+    bstr_xappend(tmp, &blob, bstr0(path));
+
+    if (serialize_menu(tmp, &blob, hmenu)) {
+        HANDLE hmap = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL,
+                                         PAGE_READWRITE, 0,
+                                         sizeof(uint64_t) + blob.len,
+                                         shared_section_name(tmp, path));
+        if (hmap != NULL && GetLastError() != ERROR_ALREADY_EXISTS) {
+            uint8_t *view = MapViewOfFile(hmap, FILE_MAP_WRITE, 0, 0, 0);
+            if (view != NULL) {
+                // records first, length last, so a racing reader never
+                // sees a partially written blob
+                memcpy(view + sizeof(uint64_t), blob.start, blob.len);
+                MemoryBarrier();
+                uint64_t len = blob.len;
+                memcpy(view, &len, sizeof(len));
+                UnmapViewOfFile(view);
+
+                // keep the section alive for the instance's lifetime
+                ctx->hshared = hmap;
+                hmap = NULL;
+            }
+        }
+        if (hmap != NULL) CloseHandle(hmap);
+    }
+
+    talloc_free(tmp);
+}
+
+void menu_cache_save(plugin_ctx *ctx, char *path, HMENU hmenu) {
+    if (bstr_startswith0(bstr0(path), "memory://")) return;
+
+    menu_cache_header hdr = {MENU_CACHE_MAGIC, MENU_CACHE_VERSION};
+    if (!cache_stat(path, &hdr.conf_size, &hdr.conf_mtime)) return;
+    hdr.path_len = strlen(path);
+
+    void *tmp = talloc_new(NULL);
+    bstr blob = bstr0(NULL);
+    bstr_xappend(tmp, &blob, (bstr){(unsigned char *)&hdr, sizeof(hdr)});
+    bstr_xappend(tmp, &blob, bstr0(path));
+
+    if (serialize_menu(tmp, &blob, hmenu)) {
+        CreateDirectoryW(mp_from_utf8(tmp, mp_expand_path(tmp,
+                                                          MENU_CACHE_DIR)),
+                         NULL);
+        wchar_t *path_w =
+            mp_from_utf8(tmp, mp_expand_path(tmp, MENU_CACHE_PATH));
+        HANDLE hFile = CreateFileW(path_w, GENERIC_WRITE, 0, NULL,
+                                   CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hFile != INVALID_HANDLE_VALUE) {
+            DWORD dwWritten;
+            WriteFile(hFile, blob.start, blob.len, &dwWritten, NULL);
+            CloseHandle(hFile);
+        }
+    }
+
+    talloc_free(tmp);
+}
@@ -0,0 +1,15 @@
+// Copyright (c) 2023 tsl0922. All rights reserved.
+// SPDX-License-Identifier: GPL-2.0-only
+
+#ifndef MPV_PLUGIN_CACHE_H
+#define MPV_PLUGIN_CACHE_H
+
+#include <windows.h>
+#include "plugin.h"
+
+HMENU menu_cache_load(plugin_ctx *ctx, char *path);
+void menu_cache_save(plugin_ctx *ctx, char *path, HMENU hmenu);
+HMENU menu_shared_load(plugin_ctx *ctx, char *path);
+void menu_shared_publish(plugin_ctx *ctx, char *path, HMENU hmenu);
+
+#endif
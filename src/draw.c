@@ -0,0 +1,256 @@
+// Copyright (c) 2023 tsl0922. All rights reserved.
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include "ta/ta_talloc.h"
+#include "draw.h"
+
+// opt-in owner-drawn menu rendering (ownerdraw=yes), DPI aware per
+// monitor: all text measurement happens once when an item is added,
+// with an HFONT cached per DPI, and the checkmark glyph is pre-rendered
+// per DPI into a monochrome bitmap. WM_MEASUREITEM then only reads the
+// cached extents and WM_DRAWITEM does one blit plus the text out, so
+// opening the popup costs the same as the system-drawn path even on
+// 4K displays at 200% scaling.
+
+#define DRAW_BASE_DPI 96
+#define DRAW_PAD 6       // item padding at 96 DPI
+#define DRAW_TAB_GAP 24  // gap between title and shortcut column at 96 DPI
+
+static bool enabled = false;
+
+// menu font cached per DPI, created lazily from the non-client metrics
+typedef struct {
+    UINT dpi;
+    HFONT font;
+} font_entry;
+
+static font_entry fonts[8];
+static int num_fonts = 0;
+
+// checkmark glyph pre-rendered per DPI: blitting a monochrome source
+// maps black to the text color and white to the background color, so a
+// single SRCCOPY draws the glyph in the right colors for free
+typedef struct {
+    UINT dpi;
+    HBITMAP bmp;
+    int size;
+} glyph_entry;
+
+static glyph_entry glyphs[8];
+static int num_glyphs = 0;
+
+// per item draw record, indexed by command id like the command table
+typedef struct {
+    wchar_t *title;  // owned copy, '\t' splits off the shortcut column
+    SIZE size;       // text extent measured at build time
+    UINT dpi;        // DPI the extent was measured for
+} draw_record;
+
+typedef struct {
+    draw_record *entries;  // indexed by id - (WM_USER + 100)
+    int num_entries;
+} draw_table;
+
+static draw_table *items = NULL;
+static HWND draw_hwnd = NULL;
+
+// memory DC kept around for measurement and glyph blits, so adding N
+// items costs N extent calls instead of N GetDC round trips
+static HDC mem_dc(void) {
+    static HDC dc = NULL;
+    if (dc == NULL) dc = CreateCompatibleDC(NULL);
+    return dc;
+}
+
+static UINT draw_dpi(void) {
+    // the prefetched build may run before the window exists, items are
+    // re-measured in WM_MEASUREITEM if the menu opens on another DPI
+    if (draw_hwnd != NULL) return GetDpiForWindow(draw_hwnd);
+    HDC dc = GetDC(NULL);
+    UINT dpi = GetDeviceCaps(dc, LOGPIXELSY);
+    ReleaseDC(NULL, dc);
+    return dpi;
+}
+
+static HFONT font_for_dpi(UINT dpi) {
+    for (int i = 0; i < num_fonts; i++) {
+        if (fonts[i].dpi == dpi) return fonts[i].font;
+    }
+
+    NONCLIENTMETRICSW ncm = {.cbSize = sizeof(ncm)};
+    if (!SystemParametersInfoForDpi(SPI_GETNONCLIENTMETRICS, sizeof(ncm),
+                                    &ncm, 0, dpi))
+        return NULL;
+    HFONT font = CreateFontIndirectW(&ncm.lfMenuFont);
+    if (font == NULL) return NULL;
+
+    if (num_fonts == ARRAYSIZE(fonts))
+        DeleteObject(fonts[--num_fonts].font);
+    fonts[num_fonts++] = (font_entry){dpi, font};
+    return font;
+}
+
+static HBITMAP glyph_for_dpi(UINT dpi, int *size) {
+    for (int i = 0; i < num_glyphs; i++) {
+        if (glyphs[i].dpi == dpi) {
+            *size = glyphs[i].size;
+            return glyphs[i].bmp;
+        }
+    }
+
+    int s = GetSystemMetricsForDpi(SM_CXMENUCHECK, dpi);
+    HBITMAP bmp = CreateBitmap(s, s, 1, 1, NULL);
+    if (bmp == NULL) return NULL;
+
+    HDC dc = mem_dc();
+    HBITMAP old = SelectObject(dc, bmp);
+    RECT rc = {0, 0, s, s};
+    FillRect(dc, &rc, (HBRUSH)GetStockObject(WHITE_BRUSH));
+    DrawFrameControl(dc, &rc, DFC_MENU, DFCS_MENUCHECK);
+    SelectObject(dc, old);
+
+    if (num_glyphs == ARRAYSIZE(glyphs))
+        DeleteObject(glyphs[--num_glyphs].bmp);
+    glyphs[num_glyphs++] = (glyph_entry){dpi, bmp, s};
+    *size = s;
+    return bmp;
+}
+
+static draw_record *record_get(UINT id) {
+    if (items == NULL) return NULL;
+    int idx = id - (WM_USER + 100);
+    if (idx < 0 || idx >= items->num_entries) return NULL;
+    return &items->entries[idx];
+}
+
+static void measure_item(draw_record *rec, UINT dpi) {
+    HDC dc = mem_dc();
+    HFONT font = font_for_dpi(dpi);
+    if (dc == NULL || font == NULL) return;
+    HFONT old = SelectObject(dc, font);
+
+    wchar_t *tab = wcschr(rec->title, L'\t');
+    int len = tab != NULL ? (int)(tab - rec->title) : (int)wcslen(rec->title);
+    SIZE left = {0}, right = {0};
+    GetTextExtentPoint32W(dc, rec->title, len, &left);
+    if (tab != NULL)
+        GetTextExtentPoint32W(dc, tab + 1, wcslen(tab + 1), &right);
+    SelectObject(dc, old);
+
+    rec->size.cx = left.cx + right.cx;
+    if (right.cx > 0)
+        rec->size.cx += MulDiv(DRAW_TAB_GAP, dpi, DRAW_BASE_DPI);
+    rec->size.cy = left.cy > right.cy ? left.cy : right.cy;
+    rec->dpi = dpi;
+}
+
+void draw_init(plugin_ctx *ctx, void *talloc_ctx) {
+    enabled = ctx->conf->ownerdraw;
+    draw_hwnd = ctx->hwnd;
+    items = talloc_zero(talloc_ctx, draw_table);
+}
+
+// record and measure an item at build time, returns false when
+// owner-drawn rendering is disabled
+bool draw_item_add(UINT id, wchar_t *title) {
+    if (!enabled) return false;
+
+    int idx = id - (WM_USER + 100);
+    while (items->num_entries <= idx) {
+        MP_TARRAY_APPEND(items, items->entries, items->num_entries,
+                         (draw_record){0});
+    }
+
+    // titles may be freed after insert (cache replay), keep a copy
+    draw_record *rec = &items->entries[idx];
+    if (rec->title != NULL) talloc_free(rec->title);
+    rec->title = talloc_memdup(items, title,
+                               (wcslen(title) + 1) * sizeof(wchar_t));
+    measure_item(rec, draw_dpi());
+    return true;
+}
+
+// drop the record of a retired id, so recycled ids start clean and the
+// title copy does not outlive its item
+void draw_item_clear(UINT id) {
+    draw_record *rec = record_get(id);
+    if (rec == NULL) return;
+    talloc_free(rec->title);
+    *rec = (draw_record){0};
+}
+
+// trim the table slack, driven by menu_compact()
+void draw_compact(void) {
+    if (items == NULL || items->entries == NULL) return;
+    items->entries = talloc_realloc(items, items->entries, draw_record,
+                                    items->num_entries);
+}
+
+bool handle_measure_item(plugin_ctx *ctx, MEASUREITEMSTRUCT *mis) {
+    if (!enabled || mis->CtlType != ODT_MENU) return false;
+    draw_record *rec = record_get(mis->itemID);
+    if (rec == NULL || rec->title == NULL) return false;
+
+    UINT dpi = GetDpiForWindow(ctx->hwnd);
+    if (rec->dpi != dpi) measure_item(rec, dpi);  // moved to another monitor
+
+    int check = GetSystemMetricsForDpi(SM_CXMENUCHECK, dpi);
+    int pad = MulDiv(DRAW_PAD, dpi, DRAW_BASE_DPI);
+    mis->itemWidth = rec->size.cx + check + pad * 3;
+    mis->itemHeight = rec->size.cy + pad * 2;
+    int min = GetSystemMetricsForDpi(SM_CYMENU, dpi);
+    if ((int)mis->itemHeight < min) mis->itemHeight = min;
+    return true;
+}
+
+bool handle_draw_item(plugin_ctx *ctx, DRAWITEMSTRUCT *dis) {
+    if (!enabled || dis->CtlType != ODT_MENU) return false;
+    draw_record *rec = record_get(dis->itemID);
+    if (rec == NULL || rec->title == NULL) return false;
+
+    HDC dc = dis->hDC;
+    RECT rc = dis->rcItem;
+    bool sel = dis->itemState & ODS_SELECTED;
+    bool off = dis->itemState & (ODS_GRAYED | ODS_DISABLED);
+
+    FillRect(dc, &rc, GetSysColorBrush(sel ? COLOR_HIGHLIGHT : COLOR_MENU));
+    SetBkColor(dc, GetSysColor(sel ? COLOR_HIGHLIGHT : COLOR_MENU));
+    SetTextColor(dc, GetSysColor(off   ? COLOR_GRAYTEXT
+                                 : sel ? COLOR_HIGHLIGHTTEXT
+                                       : COLOR_MENUTEXT));
+
+    UINT dpi = GetDpiForWindow(ctx->hwnd);
+    int check = GetSystemMetricsForDpi(SM_CXMENUCHECK, dpi);
+    int pad = MulDiv(DRAW_PAD, dpi, DRAW_BASE_DPI);
+
+    if (dis->itemState & ODS_CHECKED) {
+        int size = 0;
+        HBITMAP bmp = glyph_for_dpi(dpi, &size);
+        if (bmp != NULL) {
+            HDC src = mem_dc();
+            HBITMAP old = SelectObject(src, bmp);
+            BitBlt(dc, rc.left + pad,
+                   rc.top + (rc.bottom - rc.top - size) / 2, size, size, src,
+                   0, 0, SRCCOPY);
+            SelectObject(src, old);
+        }
+    }
+
+    HFONT old = SelectObject(dc, font_for_dpi(dpi));
+    SetBkMode(dc, TRANSPARENT);
+
+    RECT text = rc;
+    text.left += check + pad * 2;
+    text.right -= pad;
+
+    wchar_t *tab = wcschr(rec->title, L'\t');
+    int len = tab != NULL ? (int)(tab - rec->title) : (int)wcslen(rec->title);
+    DrawTextW(dc, rec->title, len, &text, DT_SINGLELINE | DT_VCENTER);
+    if (tab != NULL) {
+        DrawTextW(dc, tab + 1, -1, &text,
+                  DT_SINGLELINE | DT_VCENTER | DT_RIGHT);
+    }
+
+    SelectObject(dc, old);
+    return true;
+}
@@ -0,0 +1,17 @@
+// Copyright (c) 2023 tsl0922. All rights reserved.
+// SPDX-License-Identifier: GPL-2.0-only
+
+#ifndef MPV_PLUGIN_DRAW_H
+#define MPV_PLUGIN_DRAW_H
+
+#include "plugin.h"
+
+// opt-in owner-drawn menu rendering, see draw.c
+void draw_init(plugin_ctx *ctx, void *talloc_ctx);
+bool draw_item_add(UINT id, wchar_t *title);
+void draw_item_clear(UINT id);
+void draw_compact(void);
+bool handle_measure_item(plugin_ctx *ctx, MEASUREITEMSTRUCT *mis);
+bool handle_draw_item(plugin_ctx *ctx, DRAWITEMSTRUCT *dis);
+
+#endif
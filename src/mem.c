@@ -0,0 +1,86 @@
+// Copyright (c) 2023 tsl0922. All rights reserved.
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include "mpv_talloc.h"
+#include "menu.h"
+#include "mem.h"
+
+// heap accounting over the vendored talloc: every plugin allocation hangs
+// off the plugin context, so the totals are one tree walk over the sizes
+// ta.c already tracks; the per-subsystem rows come from the module-local
+// contexts. With memcap set, exceeding the cap triggers compaction: the
+// caches that only exist to make rebuilds cheap are flushed, the
+// geometric append slack of the cached lists is trimmed, and interned
+// strings nobody references anymore are swept. Everything regrows on
+// demand, so long-running instances trade one slower rebuild for a
+// bounded heap.
+
+#define MEM_MAX_STATS 16
+
+static int mem_collect(plugin_ctx *ctx, mem_stat *stats) {
+    int n = 0;
+    // the walk reads sizes the window thread may be mutating
+    menu_lock();
+    stats[n] = (mem_stat){.name = "total"};
+    stats[n].bytes = talloc_total_size(ctx, &stats[n].allocs);
+    n++;
+    stats[n] = (mem_stat){.name = "state"};
+    stats[n].bytes = talloc_total_size(ctx->state, &stats[n].allocs);
+    n++;
+    n += menu_mem_stats(stats + n, MEM_MAX_STATS - n);
+    menu_unlock();
+    return n;
+}
+
+// publish the per-subsystem byte and allocation counts to
+// user-data/menu/mem as a node map, same surface as the perf histograms
+void mem_publish(plugin_ctx *ctx) {
+    mem_stat stats[MEM_MAX_STATS];
+    int n = mem_collect(ctx, stats);
+
+    void *tmp = talloc_new(NULL);
+
+    mpv_node_list *list = talloc_zero(tmp, mpv_node_list);
+    list->num = n;
+    list->keys = talloc_array(tmp, char *, n);
+    list->values = talloc_zero_array(tmp, mpv_node, n);
+
+    for (int i = 0; i < n; i++) {
+        mpv_node_list *entry = talloc_zero(tmp, mpv_node_list);
+        entry->num = 2;
+        entry->keys = talloc_array(tmp, char *, entry->num);
+        entry->values = talloc_zero_array(tmp, mpv_node, entry->num);
+        entry->keys[0] = "bytes";
+        entry->values[0] = (mpv_node){.format = MPV_FORMAT_INT64,
+                                      .u.int64 = stats[i].bytes};
+        entry->keys[1] = "allocs";
+        entry->values[1] = (mpv_node){.format = MPV_FORMAT_INT64,
+                                      .u.int64 = stats[i].allocs};
+
+        list->keys[i] = (char *)stats[i].name;
+        list->values[i] =
+            (mpv_node){.format = MPV_FORMAT_NODE_MAP, .u.list = entry};
+    }
+
+    mpv_node node = {.format = MPV_FORMAT_NODE_MAP, .u.list = list};
+    mpv_set_property(ctx->mpv, "user-data/menu/mem", MPV_FORMAT_NODE, &node);
+
+    talloc_free(tmp);
+}
+
+// compact when the heap exceeds the configured cap, called when the event
+// loop goes idle so the walk never sits on the popup hot path
+void mem_check(plugin_ctx *ctx) {
+    if (ctx->conf->memcap <= 0) return;
+
+    // the state-list writers (mp_state_update/mp_state_flush) and the
+    // window thread's readers (handle_init_menu) all hold the menu lock,
+    // so compacting under it is safe
+    menu_lock();
+    size_t cap = (size_t)ctx->conf->memcap * 1024 * 1024;
+    if (talloc_total_size(ctx, NULL) > cap) {
+        mp_state_compact(ctx->state);
+        menu_compact();
+    }
+    menu_unlock();
+}
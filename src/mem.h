@@ -0,0 +1,20 @@
+// Copyright (c) 2023 tsl0922. All rights reserved.
+// SPDX-License-Identifier: GPL-2.0-only
+
+#ifndef MPV_PLUGIN_MEM_H
+#define MPV_PLUGIN_MEM_H
+
+#include <stddef.h>
+#include "plugin.h"
+
+// one accounted subsystem
+typedef struct {
+    const char *name;  // static subsystem name
+    size_t bytes;      // total talloc bytes under the subsystem
+    size_t allocs;     // number of live allocations
+} mem_stat;
+
+void mem_publish(plugin_ctx *ctx);
+void mem_check(plugin_ctx *ctx);
+
+#endif
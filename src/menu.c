@@ -1,18 +1,117 @@
 // Copyright (c) 2023 tsl0922. All rights reserved.
 // SPDX-License-Identifier: GPL-2.0-only
 
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
 #include "misc/bstr.h"
+#include "osdep/threads.h"
+#include "cache.h"
+#include "draw.h"
+#include "scan.h"
 #include "menu.h"
+#include "perf.h"
 
 #define MENU_PREFIX "#menu:"
 #define MENU_PREFIX_UOSC "#!"
 #define MENU_PREFIX_DYN "#@"
+#define MENU_PREFIX_INCLUDE "#@include"
+
+// everything allocated for one menu generation (the tables, arenas,
+// commands and titles) hangs off this context, so a reload frees the
+// previous generation wholesale instead of leaking it until shutdown
+static void *menu_ctx = NULL;
+
+void *menu_gen_ctx(void) {
+    return menu_ctx;
+}
+
+// the menu tables are mutated from two threads: the window thread
+// (WM_INITMENUPOPUP, WM_COMMAND) and the mpv thread (reloads, script
+// messages, idle compaction). Every public entry point below takes this
+// lock; the helpers shared with cache.c run inside load_menu's critical
+// section and stay lockless, the SRWLOCK is not recursive
+static mp_mutex menu_mutex = MP_STATIC_MUTEX_INITIALIZER;
+
+void menu_lock(void) {
+    mp_mutex_lock(&menu_mutex);
+}
+
+void menu_unlock(void) {
+    mp_mutex_unlock(&menu_mutex);
+}
+
+// bump arena, reset by a pointer assignment; the backing block retains
+// (and grows to) the high-water mark of a cycle, so once a menu reached
+// its steady-state size a rebuild does no heap traffic at all
+typedef struct {
+    char *buf;      // backing block
+    size_t size;
+    size_t pos;
+    size_t need;    // bytes requested this cycle, may exceed size
+    void *overflow; // talloc ctx for allocations that did not fit
+} mp_arena;
+
+static void arena_init(mp_arena *a, void *talloc_ctx, size_t size) {
+    a->buf = talloc_size(talloc_ctx, size);
+    a->size = size;
+    a->pos = 0;
+    a->need = 0;
+    a->overflow = talloc_new(talloc_ctx);
+}
+
+static void *arena_alloc(mp_arena *a, size_t size) {
+    size = (size + 15) & ~(size_t)15;
+    a->need += size;
+    if (a->pos + size > a->size) return talloc_size(a->overflow, size);
+    void *p = a->buf + a->pos;
+    a->pos += size;
+    return p;
+}
+
+static void arena_reset(mp_arena *a) {
+    if (a->need > a->size) {
+        a->size = a->need;
+        a->buf = talloc_realloc_size(NULL, a->buf, a->size);
+    }
+    a->pos = 0;
+    a->need = 0;
+    talloc_free_children(a->overflow);
+}
+
+static char *arena_asprintf(mp_arena *a, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+
+    char *p = arena_alloc(a, n + 1);
+    va_start(ap, fmt);
+    vsnprintf(p, n + 1, fmt, ap);
+    va_end(ap);
+    return p;
+}
 
 typedef struct dyn_item {
-    HMENU hmenu;       // submenu handle
-    UINT id;           // menu command id
-    void *talloc_ctx;  // talloc context
+    HMENU hmenu;        // submenu handle
+    HMENU parent;       // parent submenu, set for page entries only
+    UINT id;            // menu command id
+    mp_arena arena;     // arena for the item titles and commands
+    char *keyword;      // provider keyword
+    int num_items;      // items currently in the submenu
+    mp_state_gen seen;  // generations applied to the submenu
+    UINT *ids;          // command ids owned by the current items
+    int num_ids;
+    int page_start;     // list range of a page entry, page_end == 0
+    int page_end;       // means the entry covers the whole list
+    bool pageable;      // provider supports range builds
+    bool paged;         // current content is page submenus
+    mp_state_gen *(*gen)(mp_state *state, struct dyn_item *item);
+    int (*count)(mp_state *state, struct dyn_item *item);
     void (*update)(mp_state *state, struct dyn_item *item);
+    void (*select)(mp_state *state, struct dyn_item *item);
+    char *(*page_label)(mp_state *state, struct dyn_item *item, mp_arena *a);
 } dyn_entry;
 
 typedef struct {
@@ -22,7 +121,14 @@ typedef struct {
 
 typedef struct {
     char *keyword;  // keyword in menu title
+    mp_state_gen *(*gen)(mp_state *state, struct dyn_item *item);
+    int (*count)(mp_state *state, struct dyn_item *item);
     void (*update)(mp_state *state, dyn_entry *item);
+    void (*select)(mp_state *state, dyn_entry *item);
+    // range support: set for providers whose submenu can grow without
+    // bound, enables pagination above the configured limit
+    bool pageable;
+    char *(*page_label)(mp_state *state, dyn_entry *item, mp_arena *a);
 } dyn_provider;
 
 // forward declarations
@@ -33,120 +139,610 @@ static void update_sub_track_menu2(mp_state *state, dyn_entry *item);
 static void update_chapter_menu(mp_state *state, dyn_entry *item);
 static void update_edition_menu(mp_state *state, dyn_entry *item);
 static void update_audio_device_menu(mp_state *state, dyn_entry *item);
+static void update_playlist_menu(mp_state *state, dyn_entry *item);
+static void select_video_track_menu(mp_state *state, dyn_entry *item);
+static void select_audio_track_menu(mp_state *state, dyn_entry *item);
+static void select_sub_track_menu(mp_state *state, dyn_entry *item);
+static void select_sub_track_menu2(mp_state *state, dyn_entry *item);
+static void select_chapter_menu(mp_state *state, dyn_entry *item);
+static void select_edition_menu(mp_state *state, dyn_entry *item);
+static void select_audio_device_menu(mp_state *state, dyn_entry *item);
+static void select_playlist_menu(mp_state *state, dyn_entry *item);
+static char *chapter_page_label(mp_state *state, dyn_entry *item,
+                                mp_arena *a);
+
+// generation accessors for the dynamic menu providers
+static mp_state_gen *track_gen(mp_state *state, dyn_entry *item) {
+    return &state->track_gen;
+}
+static mp_state_gen *chapter_gen(mp_state *state, dyn_entry *item) {
+    return &state->chapter_gen;
+}
+static mp_state_gen *edition_gen(mp_state *state, dyn_entry *item) {
+    return &state->edition_gen;
+}
+static mp_state_gen *audio_device_gen(mp_state *state, dyn_entry *item) {
+    return &state->audio_device_gen;
+}
+static mp_state_gen *playlist_gen(mp_state *state, dyn_entry *item) {
+    return &state->playlist_gen;
+}
+
+// item count accessors, used to gray out empty submenu entries without
+// materializing their content
+static int count_tracks(mp_state *state, const char *type) {
+    mp_track_list *list = state->track_list;
+    if (list == NULL) return 0;
+
+    // track types are interned, so the filter is pointer equality
+    char *type_i = mp_intern_get(state, type);
+    if (type_i == NULL) return 0;
 
-// dynamic menu providers
-static const dyn_provider dyn_providers[] = {
-    {"tracks/video", update_video_track_menu},
-    {"tracks/audio", update_audio_track_menu},
-    {"tracks/sub", update_sub_track_menu},
-    {"tracks/sub-secondary", update_sub_track_menu2},
-    {"chapters", update_chapter_menu},
-    {"editions", update_edition_menu},
-    {"audio-devices", update_audio_device_menu},
+    int count = 0;
+    for (int i = 0; i < list->num_entries; i++) {
+        if (list->entries[i].type == type_i) count++;
+    }
+    return count;
+}
+
+static int count_video_tracks(mp_state *state, dyn_entry *item) {
+    return count_tracks(state, "video");
+}
+static int count_audio_tracks(mp_state *state, dyn_entry *item) {
+    return count_tracks(state, "audio");
+}
+static int count_sub_tracks(mp_state *state, dyn_entry *item) {
+    return count_tracks(state, "sub");
+}
+static int count_chapters(mp_state *state, dyn_entry *item) {
+    return state->chapter_list ? state->chapter_list->num_entries : 0;
+}
+static int count_editions(mp_state *state, dyn_entry *item) {
+    return state->edition_list ? state->edition_list->num_entries : 0;
+}
+static int count_audio_devices(mp_state *state, dyn_entry *item) {
+    return state->audio_device_list ? state->audio_device_list->num_entries
+                                    : 0;
+}
+static int count_playlist(mp_state *state, dyn_entry *item) {
+    int count = state->playlist ? state->playlist->num_entries : 0;
+    if (state->file_list != NULL) count += state->file_list->num_entries;
+    return count;
+}
+
+// built-in dynamic menu providers
+static const dyn_provider dyn_builtins[] = {
+    {"tracks/video", track_gen, count_video_tracks, update_video_track_menu,
+     select_video_track_menu},
+    {"tracks/audio", track_gen, count_audio_tracks, update_audio_track_menu,
+     select_audio_track_menu},
+    {"tracks/sub", track_gen, count_sub_tracks, update_sub_track_menu,
+     select_sub_track_menu},
+    {"tracks/sub-secondary", track_gen, count_sub_tracks,
+     update_sub_track_menu2, select_sub_track_menu2},
+    {"chapters", chapter_gen, count_chapters, update_chapter_menu,
+     select_chapter_menu, .pageable = true, .page_label = chapter_page_label},
+    {"editions", edition_gen, count_editions, update_edition_menu,
+     select_edition_menu},
+    {"audio-devices", audio_device_gen, count_audio_devices,
+     update_audio_device_menu, select_audio_device_menu, .pageable = true},
+    {"playlist", playlist_gen, count_playlist, update_playlist_menu,
+     select_playlist_menu},
 };
 
+// provider registry, sorted by keyword so the parse-time lookup is a
+// binary search; the builtins register at the first load and scripts can
+// add their own keywords at runtime
+static dyn_provider *registry = NULL;
+static int num_registered = 0;
+static void *registry_ctx = NULL;
+
+static int registry_lower_bound(const char *keyword) {
+    int lo = 0, hi = num_registered;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (strcmp(registry[mid].keyword, keyword) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static void dyn_provider_register(dyn_provider provider) {
+    int at = registry_lower_bound(provider.keyword);
+    if (at < num_registered &&
+        strcmp(registry[at].keyword, provider.keyword) == 0) {
+        registry[at] = provider;  // re-registration replaces
+        return;
+    }
+    MP_TARRAY_INSERT_AT(registry_ctx, registry, num_registered, at, provider);
+}
+
+static dyn_provider *dyn_provider_find(bstr keyword) {
+    int lo = 0, hi = num_registered;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        int cmp = bstrcmp(keyword, bstr0(registry[mid].keyword));
+        if (cmp == 0) return &registry[mid];
+        if (cmp < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return NULL;
+}
+
+// a script-provided submenu: the items are cached here when the script
+// publishes them, so the popup never waits on a script round trip
+typedef struct {
+    bstr title;  // item title, "-" for a separator
+    bstr cmd;    // command executed on click
+} script_item;
+
+typedef struct {
+    char *keyword;
+    mp_state_gen gen;
+    script_item *items;
+    int num_items;
+    char *strings;  // flat buffer backing the item views
+} script_provider;
+
+static script_provider **scripts = NULL;
+static int num_scripts = 0;
+
+static script_provider *script_find(const char *keyword) {
+    for (int i = 0; i < num_scripts; i++) {
+        if (strcmp(scripts[i]->keyword, keyword) == 0) return scripts[i];
+    }
+    return NULL;
+}
+
 // dynamic menu list
 static dyn_list *dyn_menus = NULL;
 
-static bool add_dyn_menu(void *talloc_ctx, HMENU hmenu, int id, bstr keyword) {
-    for (int i = 0; i < ARRAYSIZE(dyn_providers); i++) {
-        dyn_provider provider = dyn_providers[i];
-        if (!bstr_equals0(keyword, provider.keyword)) continue;
+// submenus whose #@ keyword had no provider at build time: remembered so
+// the compiled cache still serializes the keyword, letting a forced
+// reload bind a script provider that registered after the menu was built
+typedef struct {
+    HMENU hmenu;
+    char *keyword;
+} unbound_dyn;
+
+static unbound_dyn *unbound = NULL;
+static int num_unbound = 0;
 
-        MP_TARRAY_APPEND(talloc_ctx, dyn_menus->entries, dyn_menus->num_entries,
-                         (dyn_entry){
-                             .hmenu = hmenu,
-                             .id = id,
-                             .talloc_ctx = talloc_new(talloc_ctx),
-                             .update = provider.update,
-                         });
-        return true;
+typedef struct {
+    HMENU parent;    // parent menu handle
+    HMENU submenu;   // submenu handle
+    UINT id;         // menu command id of the submenu item
+    wchar_t *title;  // escaped submenu title
+} submenu_entry;
+
+typedef struct {
+    submenu_entry *entries;  // open addressing, keyed by (parent, title)
+    int size;                // allocated size, power of two
+    int used;
+} submenu_index;
+
+// submenu index, so lookup never touches the Win32 API
+static submenu_index *submenus = NULL;
+
+bool add_dyn_menu(void *talloc_ctx, HMENU hmenu, int id, bstr keyword) {
+    dyn_provider *provider = dyn_provider_find(keyword);
+    if (provider == NULL) {
+        unbound_dyn miss = {hmenu, bstrdup0(talloc_ctx, keyword)};
+        MP_TARRAY_APPEND(talloc_ctx, unbound, num_unbound, miss);
+        return false;
     }
-    return false;
+
+    dyn_entry entry = {
+        .hmenu = hmenu,
+        .id = id,
+        .keyword = bstrdup0(talloc_ctx, keyword),
+        .seen = {UINT64_MAX, UINT64_MAX},
+        .gen = provider->gen,
+        .count = provider->count,
+        .update = provider->update,
+        .select = provider->select,
+        .pageable = provider->pageable,
+        .page_label = provider->page_label,
+    };
+    arena_init(&entry.arena, talloc_ctx, 4096);
+    MP_TARRAY_APPEND(talloc_ctx, dyn_menus->entries, dyn_menus->num_entries,
+                     entry);
+    return true;
 }
 
-static HMENU find_submenu(HMENU hmenu, wchar_t *name, UINT *id) {
-    MENUITEMINFOW mii;
-    int count = GetMenuItemCount(hmenu);
-
-    for (int i = 0; i < count; i++) {
-        memset(&mii, 0, sizeof(mii));
-        mii.cbSize = sizeof(mii);
-        mii.fMask = MIIM_STRING;
-        if (!GetMenuItemInfoW(hmenu, i, TRUE, &mii) || mii.cch == 0) continue;
-
-        mii.cch++;
-        wchar_t buf[mii.cch];
-        mii.dwTypeData = buf;
-        mii.fMask |= MIIM_ID | MIIM_SUBMENU;
-        if (!GetMenuItemInfoW(hmenu, i, TRUE, &mii) || !mii.hSubMenu) continue;
-        if (wcscmp(mii.dwTypeData, name) == 0) {
-            if (id) *id = mii.wID;
-            return mii.hSubMenu;
-        }
+char *dyn_menu_keyword(HMENU hmenu) {
+    if (dyn_menus == NULL) return NULL;
+
+    for (int i = 0; i < dyn_menus->num_entries; i++) {
+        if (dyn_menus->entries[i].hmenu == hmenu)
+            return dyn_menus->entries[i].keyword;
+    }
+    for (int i = 0; i < num_unbound; i++) {
+        if (unbound[i].hmenu == hmenu) return unbound[i].keyword;
     }
     return NULL;
 }
 
-// escape & to && for menu title
-static wchar_t *escape_title(void *talloc_ctx, bstr title) {
-    void *tmp = talloc_new(NULL);
-    bstr left, rest;
-    bstr escaped = bstr0(NULL);
+// FNV-1a over parent handle and title
+static uint64_t submenu_hash(HMENU parent, wchar_t *title) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    uintptr_t p = (uintptr_t)parent;
+    for (size_t i = 0; i < sizeof(p); i++, p >>= 8)
+        h = (h ^ (p & 0xff)) * 0x100000001b3ULL;
+    for (; *title; title++) h = (h ^ *title) * 0x100000001b3ULL;
+    return h;
+}
 
-    left = bstr_split(title, "&", &rest);
-    while (rest.len > 0) {
-        bstr_xappend(tmp, &escaped, left);
-        bstr_xappend(tmp, &escaped, bstr0("&&"));
-        left = bstr_split(rest, "&", &rest);
+static void submenu_index_init(void *talloc_ctx) {
+    submenus = talloc_zero(talloc_ctx, submenu_index);
+    submenus->size = 64;
+    submenus->entries =
+        talloc_zero_array(submenus, submenu_entry, submenus->size);
+}
+
+// find the slot holding (parent, title), or the empty slot to insert it at
+static submenu_entry *submenu_slot(HMENU parent, wchar_t *title) {
+    int mask = submenus->size - 1;
+    for (int i = submenu_hash(parent, title) & mask;; i = (i + 1) & mask) {
+        submenu_entry *entry = &submenus->entries[i];
+        if (entry->submenu == NULL) return entry;
+        if (entry->parent == parent && wcscmp(entry->title, title) == 0)
+            return entry;
     }
-    bstr_xappend(tmp, &escaped, left);
+}
 
-    wchar_t *ret = mp_from_utf8(talloc_ctx, bstrdup0(tmp, escaped));
-    talloc_free(tmp);
-    return ret;
+static void submenu_index_add(HMENU parent, wchar_t *title, HMENU submenu,
+                              UINT id) {
+    if (submenus->used * 4 >= submenus->size * 3) {
+        submenu_entry *old = submenus->entries;
+        int old_size = submenus->size;
+        submenus->size *= 2;
+        submenus->entries =
+            talloc_zero_array(submenus, submenu_entry, submenus->size);
+        for (int i = 0; i < old_size; i++) {
+            if (old[i].submenu == NULL) continue;
+            *submenu_slot(old[i].parent, old[i].title) = old[i];
+        }
+        talloc_free(old);
+    }
+
+    submenu_entry *entry = submenu_slot(parent, title);
+    if (entry->submenu != NULL) return;
+    *entry = (submenu_entry){
+        .parent = parent,
+        .submenu = submenu,
+        .id = id,
+        .title = talloc_memdup(submenus, title,
+                               (wcslen(title) + 1) * sizeof(wchar_t)),
+    };
+    submenus->used++;
 }
 
-// format title as name\tkey
-static wchar_t *format_title(void *talloc_ctx, bstr name, bstr key) {
-    void *tmp = talloc_new(NULL);
-    bstr title = bstrdup(tmp, name);
+static HMENU find_submenu(HMENU hmenu, wchar_t *name, UINT *id) {
+    if (submenus == NULL) return NULL;
+
+    submenu_entry *entry = submenu_slot(hmenu, name);
+    if (entry->submenu == NULL) return NULL;
+    if (id) *id = entry->id;
+    return entry->submenu;
+}
 
-    if (key.len > 0 && !bstr_equals0(key, "_")) {
-        bstr_xappend(tmp, &title, bstr0("\t"));
-        bstr_xappend(tmp, &title, key);
+// scratch buffer reused across title building calls, it retains its
+// high-water-mark capacity so steady state does no heap traffic
+static char *scratch_buf = NULL;
+
+static void scratch_init(void *talloc_ctx) {
+    scratch_buf = talloc_size(talloc_ctx, 256);
+}
+
+static char *scratch_get(size_t size) {
+    if (talloc_get_size(scratch_buf) < size)
+        scratch_buf = talloc_realloc_size(NULL, scratch_buf, size);
+    return scratch_buf;
+}
+
+static size_t append_escaped(char *buf, size_t n, bstr s) {
+    for (size_t i = 0; i < s.len; i++) {
+        if (s.start[i] == '&') buf[n++] = '&';
+        buf[n++] = s.start[i];
     }
+    return n;
+}
 
-    wchar_t *ret = escape_title(talloc_ctx, title);
-    talloc_free(tmp);
-    return ret;
+typedef struct {
+    uint64_t hash;   // content hash of (name, key)
+    bstr name;       // source strings, owned by the cache
+    bstr key;
+    wchar_t *title;  // converted title, owned by the cache
+} title_cache_entry;
+
+typedef struct {
+    title_cache_entry *entries;  // open addressing, keyed by content
+    int size;                    // allocated size, power of two
+    int used;
+} title_cache;
+
+// UTF-8 to UTF-16 title cache: dynamic submenus rebuild with mostly the
+// same titles (track names, languages, "Off"), so the escape pass and the
+// MultiByteToWideChar call run once per distinct title, not once per popup
+static title_cache *titles = NULL;
+
+static void title_cache_init(void *talloc_ctx) {
+    titles = talloc_zero(talloc_ctx, title_cache);
+    titles->size = 256;
+    titles->entries =
+        talloc_zero_array(titles, title_cache_entry, titles->size);
+}
+
+// FNV-1a over name and key, with a separator byte between them
+static uint64_t title_hash(bstr name, bstr key) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < name.len; i++)
+        h = (h ^ name.start[i]) * 0x100000001b3ULL;
+    h = (h ^ 0x1f) * 0x100000001b3ULL;
+    for (size_t i = 0; i < key.len; i++)
+        h = (h ^ key.start[i]) * 0x100000001b3ULL;
+    return h;
+}
+
+// find the slot holding (name, key), or the empty slot to insert it at
+static title_cache_entry *title_slot(uint64_t hash, bstr name, bstr key) {
+    int mask = titles->size - 1;
+    for (int i = hash & mask;; i = (i + 1) & mask) {
+        title_cache_entry *entry = &titles->entries[i];
+        if (entry->title == NULL) return entry;
+        if (entry->hash == hash && bstr_equals(entry->name, name) &&
+            bstr_equals(entry->key, key))
+            return entry;
+    }
+}
+
+// build the UTF-16 title as name\tkey, escaping & to &&, with a single
+// conversion call per title and no intermediate allocation; the returned
+// string is owned by the cache and stays valid until the menu is reloaded,
+// callers hand it to the Win32 API which copies it at insert time
+static wchar_t *make_title(bstr name, bstr key) {
+    uint64_t hash = title_hash(name, key);
+    title_cache_entry *entry = title_slot(hash, name, key);
+    if (entry->title != NULL) return entry->title;
+
+    bool escape = name.len > 0 && memchr(name.start, '&', name.len) != NULL;
+    if (key.len > 0) escape |= memchr(key.start, '&', key.len) != NULL;
+
+    wchar_t *title;
+    if (!escape && key.len == 0) {
+        title = mp_from_utf8_bstr(titles, name);
+    } else {
+        char *buf = scratch_get(2 * (name.len + key.len) + 1);
+        size_t n = append_escaped(buf, 0, name);
+        if (key.len > 0) {
+            buf[n++] = '\t';
+            n = append_escaped(buf, n, key);
+        }
+        title = mp_from_utf8_bstr(titles, (bstr){(unsigned char *)buf, n});
+    }
+
+    if (titles->used * 4 >= titles->size * 3) {
+        title_cache_entry *old = titles->entries;
+        int old_size = titles->size;
+        titles->size *= 2;
+        titles->entries =
+            talloc_zero_array(titles, title_cache_entry, titles->size);
+        for (int i = 0; i < old_size; i++) {
+            if (old[i].title == NULL) continue;
+            *title_slot(old[i].hash, old[i].name, old[i].key) = old[i];
+        }
+        talloc_free(old);
+        entry = title_slot(hash, name, key);
+    }
+
+    *entry = (title_cache_entry){
+        .hash = hash,
+        .name = bstrdup(titles, name),
+        .key = bstrdup(titles, key),
+        .title = title,
+    };
+    titles->used++;
+    return title;
+}
+
+// escape & to && for menu title
+static wchar_t *escape_title(bstr title) {
+    return make_title(title, bstr0(NULL));
+}
+
+// format title as name\tkey
+static wchar_t *format_title(bstr name, bstr key) {
+    if (key.len > 0 && !bstr_equals0(key, "_"))
+        return make_title(name, key);
+    return make_title(name, bstr0(NULL));
+}
+
+// menu command id counter
+static UINT next_menu_id = WM_USER + 100;
+
+// flat id -> command table: ids are dense (allocated from next_menu_id),
+// so WM_COMMAND dispatch is one indexed load instead of a recursive
+// GetMenuItemInfoW search over the whole tree
+typedef struct {
+    menu_cmd **entries;  // indexed by id - (WM_USER + 100)
+    int num_entries;
+} cmd_table;
+
+static cmd_table *cmds = NULL;
+
+// retired ids, handed back out before next_menu_id grows: dynamic
+// submenus rebuild on every list change and WM_COMMAND only delivers
+// 16 bits of the id, so without recycling a long session would wrap
+// next_menu_id into ids still live in the menu
+static UINT *free_ids = NULL;
+static int num_free_ids = 0;
+
+// ids handed out while a dynamic rebuild is in flight, recorded so the
+// entry knows exactly which ids it owns and can retire them later
+static UINT *collect_ids = NULL;
+static int num_collect = 0;
+static bool collecting = false;
+
+static void cmd_table_init(void *talloc_ctx) {
+    cmds = talloc_zero(talloc_ctx, cmd_table);
+    free_ids = NULL;
+    num_free_ids = 0;
+    collect_ids = NULL;
+    num_collect = 0;
+    collecting = false;
+}
+
+static UINT menu_id_alloc(void) {
+    UINT id = num_free_ids > 0 ? free_ids[--num_free_ids] : next_menu_id++;
+    if (collecting) MP_TARRAY_APPEND(cmds, collect_ids, num_collect, id);
+    return id;
+}
+
+static void cmd_table_set(UINT id, menu_cmd *cmd) {
+    int idx = id - (WM_USER + 100);
+    while (cmds->num_entries <= idx)
+        MP_TARRAY_APPEND(cmds, cmds->entries, cmds->num_entries, NULL);
+    cmds->entries[idx] = cmd;
+}
+
+static menu_cmd *cmd_table_get(UINT id) {
+    if (cmds == NULL) return NULL;
+    int idx = id - (WM_USER + 100);
+    if (idx < 0 || idx >= cmds->num_entries) return NULL;
+    return cmds->entries[idx];
 }
 
-static int append_menu(HMENU hmenu, UINT fMask, UINT fType, UINT fState,
-                       wchar_t *title, HMENU submenu, void *data) {
-    static UINT id = WM_USER + 100;
+static MENUITEMINFOW make_menu_item(UINT fMask, UINT fType, UINT fState,
+                                    wchar_t *title, HMENU submenu,
+                                    void *data) {
     MENUITEMINFOW mii = {0};
 
     mii.cbSize = sizeof(mii);
     mii.fMask = MIIM_ID | fMask;
-    mii.wID = id++;
+    mii.wID = menu_id_alloc();
 
     if (fMask & MIIM_FTYPE) mii.fType = fType;
     if (fMask & MIIM_STATE) mii.fState = fState;
     if (fMask & MIIM_STRING) {
         mii.dwTypeData = title;
         mii.cch = wcslen(title);
+        if (draw_item_add(mii.wID, title)) {
+            mii.fMask |= MIIM_FTYPE;
+            mii.fType |= MFT_OWNERDRAW;
+        }
     }
     if (fMask & MIIM_SUBMENU) mii.hSubMenu = submenu;
-    if (fMask & MIIM_DATA) mii.dwItemData = (ULONG_PTR)data;
+    if (fMask & MIIM_DATA) {
+        mii.dwItemData = (ULONG_PTR)data;
+        cmd_table_set(mii.wID, data);
+    }
+
+    return mii;
+}
 
+int append_menu(HMENU hmenu, UINT fMask, UINT fType, UINT fState,
+                wchar_t *title, HMENU submenu, void *data) {
+    MENUITEMINFOW mii = make_menu_item(fMask, fType, fState, title, submenu,
+                                       data);
     return InsertMenuItemW(hmenu, -1, TRUE, &mii) ? mii.wID : -1;
 }
 
-static int append_seprator(HMENU hmenu) {
+int append_seprator(HMENU hmenu) {
     return append_menu(hmenu, MIIM_FTYPE, MFT_SEPARATOR, 0, NULL, NULL, NULL);
 }
 
+// tokenize a command into a NULL-terminated argv once at build time, so the
+// click path does no string parsing; commands with quoting, escapes or
+// multiple subcommands keep the string form and take the parser path
+menu_cmd *menu_cmd_parse(void *talloc_ctx, char *text) {
+    menu_cmd *cmd = talloc_zero(talloc_ctx, menu_cmd);
+    cmd->text = text;
+
+    if (strpbrk(text, "\"'`;#\\") != NULL) return cmd;
+
+    char *buf = talloc_strdup(cmd, text);
+    int num = 0;
+    for (char *p = buf; *p != '\0';) {
+        while (*p != '\0' && strchr(WHITESPACE, *p) != NULL) *p++ = '\0';
+        if (*p == '\0') break;
+        MP_TARRAY_APPEND(cmd, cmd->args, num, p);
+        while (*p != '\0' && strchr(WHITESPACE, *p) == NULL) p++;
+    }
+    if (cmd->args != NULL) MP_TARRAY_APPEND(cmd, cmd->args, num, NULL);
+    return cmd;
+}
+
+// menu_cmd_parse() variant for the dynamic providers, everything lands in
+// the item arena; the token count is known after one scan so the argv is
+// allocated exactly, with no growable array
+static menu_cmd *cmd_parse_arena(mp_arena *a, char *text) {
+    menu_cmd *cmd = arena_alloc(a, sizeof(menu_cmd));
+    *cmd = (menu_cmd){.text = text};
+
+    if (strpbrk(text, "\"'`;#\\") != NULL) return cmd;
+
+    size_t len = strlen(text);
+    char *buf = arena_alloc(a, len + 1);
+    memcpy(buf, text, len + 1);
+
+    int num = 0;
+    for (char *p = buf; *p != '\0';) {
+        while (*p != '\0' && strchr(WHITESPACE, *p) != NULL) p++;
+        if (*p == '\0') break;
+        num++;
+        while (*p != '\0' && strchr(WHITESPACE, *p) == NULL) p++;
+    }
+    if (num == 0) return cmd;
+
+    cmd->args = arena_alloc(a, (num + 1) * sizeof(char *));
+    int i = 0;
+    for (char *p = buf; *p != '\0';) {
+        while (*p != '\0' && strchr(WHITESPACE, *p) != NULL) *p++ = '\0';
+        if (*p == '\0') break;
+        cmd->args[i++] = p;
+        while (*p != '\0' && strchr(WHITESPACE, *p) == NULL) p++;
+    }
+    cmd->args[i] = NULL;
+    return cmd;
+}
+
+// menu builder, accumulates item records and inserts them in one batch
+// while tracking counts locally, so providers never call GetMenuItemCount
+typedef struct {
+    HMENU hmenu;  // target menu
+    MENUITEMINFOW *items;
+    int num_items;  // accumulated records not yet flushed
+    int count;      // items inserted into the target menu
+} menu_builder;
+
+static void mb_init(menu_builder *mb, HMENU hmenu, mp_arena *arena,
+                    int max_items) {
+    *mb = (menu_builder){
+        .hmenu = hmenu,
+        .items = arena_alloc(arena, max_items * sizeof(MENUITEMINFOW)),
+    };
+}
+
+static int mb_append(menu_builder *mb, UINT fMask, UINT fType, UINT fState,
+                     wchar_t *title, HMENU submenu, void *data) {
+    MENUITEMINFOW mii = make_menu_item(fMask, fType, fState, title, submenu,
+                                       data);
+    mb->items[mb->num_items++] = mii;
+    return mii.wID;
+}
+
+static void mb_flush(menu_builder *mb) {
+    for (int i = 0; i < mb->num_items; i++)
+        InsertMenuItemW(mb->hmenu, -1, TRUE, &mb->items[i]);
+    mb->count += mb->num_items;
+    mb->num_items = 0;
+}
+
 static HMENU append_submenu(HMENU hmenu, wchar_t *title, int *id) {
     HMENU menu = find_submenu(hmenu, title, id);
     if (menu != NULL) return menu;
@@ -155,37 +751,83 @@ static HMENU append_submenu(HMENU hmenu, wchar_t *title, int *id) {
     int wid =
         append_menu(hmenu, MIIM_STRING | MIIM_SUBMENU, 0, 0, title, menu, NULL);
     if (id) *id = wid;
+    if (wid > 0 && submenus != NULL) submenu_index_add(hmenu, title, menu, wid);
     return menu;
 }
 
+// compute the check state of a track menu item
+static UINT track_item_state(mp_track_item *entry, const char *type,
+                             int64_t pos) {
+    UINT fState = entry->selected ? MFS_CHECKED : MFS_UNCHECKED;
+    if (strcmp(type, "sub") == 0 && entry->selected && pos != entry->id)
+        fState |= MFS_DISABLED;
+    return fState;
+}
+
+// patch check states of a track menu without rebuilding it
+static void patch_track_menu(mp_state *state, dyn_entry *item,
+                             const char *type, int64_t pos) {
+    mp_track_list *list = state->track_list;
+    if (list == NULL || list->num_entries == 0) return;
+
+    char *type_i = mp_intern_get(state, type);
+    if (type_i == NULL) return;
+
+    MENUITEMINFOW mii = {0};
+    mii.cbSize = sizeof(mii);
+    mii.fMask = MIIM_STATE;
+
+    int idx = 0;
+    for (int i = 0; i < list->num_entries; i++) {
+        mp_track_item *entry = &list->entries[i];
+        if (entry->type != type_i) continue;
+        mii.fState = track_item_state(entry, type, pos);
+        SetMenuItemInfoW(item->hmenu, idx++, TRUE, &mii);
+    }
+
+    // trailing "Off" item
+    if (idx > 0) {
+        mii.fState = pos < 0 ? MFS_CHECKED : MFS_UNCHECKED;
+        SetMenuItemInfoW(item->hmenu, idx, TRUE, &mii);
+    }
+}
+
 static void update_track_menu(mp_state *state, dyn_entry *item,
                               const char *type, const char *prop, int64_t pos) {
     mp_track_list *list = state->track_list;
     if (list == NULL || list->num_entries == 0) return;
 
-    int count = GetMenuItemCount(item->hmenu);
+    char *type_i = mp_intern_get(state, type);
+    if (type_i == NULL) return;
+
+    menu_builder mb;
+    mb_init(&mb, item->hmenu, &item->arena, list->num_entries + 1);
 
     for (int i = 0; i < list->num_entries; i++) {
         mp_track_item *entry = &list->entries[i];
-        if (strcmp(entry->type, type) != 0) continue;
-
-        UINT fState = entry->selected ? MFS_CHECKED : MFS_UNCHECKED;
-        if (strcmp(type, "sub") == 0 && entry->selected && pos != entry->id)
-            fState |= MFS_DISABLED;
-        append_menu(
-            item->hmenu, MIIM_STRING | MIIM_DATA | MIIM_STATE, 0, fState,
-            format_title(item->talloc_ctx, bstr0(entry->title),
-                         bstr0(entry->lang)),
+        if (entry->type != type_i) continue;
+
+        UINT fState = track_item_state(entry, type, pos);
+        mb_append(
+            &mb, MIIM_STRING | MIIM_DATA | MIIM_STATE, 0, fState,
+            format_title(entry->title, entry->lang),
             NULL,
-            talloc_asprintf(item->talloc_ctx, "set %s %d", prop, entry->id));
+            cmd_parse_arena(&item->arena,
+                            arena_asprintf(&item->arena, "set %s %d",
+                                           prop, entry->id)));
     }
 
-    if (GetMenuItemCount(item->hmenu) > count) {
-        append_menu(item->hmenu, MIIM_STRING | MIIM_DATA | MIIM_STATE, 0,
-                    pos < 0 ? MFS_CHECKED : MFS_UNCHECKED,
-                    escape_title(item->talloc_ctx, bstr0("Off")), NULL,
-                    talloc_asprintf(item->talloc_ctx, "set %s no", prop));
+    if (mb.num_items > 0) {
+        mb_append(&mb, MIIM_STRING | MIIM_DATA | MIIM_STATE, 0,
+                  pos < 0 ? MFS_CHECKED : MFS_UNCHECKED,
+                  escape_title(bstr0("Off")), NULL,
+                  cmd_parse_arena(&item->arena,
+                                  arena_asprintf(&item->arena,
+                                                 "set %s no", prop)));
     }
+
+    mb_flush(&mb);
+    item->num_items = mb.count;
 }
 
 static void update_video_track_menu(mp_state *state, dyn_entry *item) {
@@ -204,99 +846,482 @@ static void update_sub_track_menu2(mp_state *state, dyn_entry *item) {
     update_track_menu(state, item, "sub", "secondary-sid", state->sid2);
 }
 
+static void select_video_track_menu(mp_state *state, dyn_entry *item) {
+    patch_track_menu(state, item, "video", state->vid);
+}
+
+static void select_audio_track_menu(mp_state *state, dyn_entry *item) {
+    patch_track_menu(state, item, "audio", state->aid);
+}
+
+static void select_sub_track_menu(mp_state *state, dyn_entry *item) {
+    patch_track_menu(state, item, "sub", state->sid);
+}
+
+static void select_sub_track_menu2(mp_state *state, dyn_entry *item) {
+    patch_track_menu(state, item, "sub", state->sid2);
+}
+
 static void update_chapter_menu(mp_state *state, dyn_entry *item) {
     mp_chapter_list *list = state->chapter_list;
     if (list == NULL || list->num_entries == 0) return;
 
-    void *tmp = talloc_new(NULL);
+    int start = item->page_start;
+    int end = item->page_end > 0 ? item->page_end : list->num_entries;
+    if (end > list->num_entries) end = list->num_entries;
+    if (start >= end) return;
 
-    for (int i = 0; i < list->num_entries; i++) {
+    menu_builder mb;
+    mb_init(&mb, item->hmenu, &item->arena, end - start);
+
+    for (int i = start; i < end; i++) {
         mp_chapter_item *entry = &list->entries[i];
         const char *time =
-            talloc_asprintf(tmp, "[%02d:%02d:%02d]", (int)entry->time / 3600,
-                            (int)entry->time / 60 % 60, (int)entry->time % 60);
-        append_menu(
-            item->hmenu, MIIM_STRING | MIIM_DATA, 0, 0,
-            format_title(item->talloc_ctx, bstr0(entry->title), bstr0(time)),
+            arena_asprintf(&item->arena, "[%02d:%02d:%02d]",
+                           (int)entry->time / 3600, (int)entry->time / 60 % 60,
+                           (int)entry->time % 60);
+        mb_append(
+            &mb, MIIM_STRING | MIIM_DATA, 0, 0,
+            format_title(entry->title, bstr0(time)),
             NULL,
-            talloc_asprintf(item->talloc_ctx, "seek %f absolute", entry->time));
+            cmd_parse_arena(&item->arena,
+                            arena_asprintf(&item->arena,
+                                           "seek %f absolute", entry->time)));
+    }
+    mb_flush(&mb);
+    item->num_items = mb.count;
+
+    if (state->chapter >= start && state->chapter < end) {
+        CheckMenuRadioItem(item->hmenu, 0, end - start - 1,
+                           state->chapter - start, MF_BYPOSITION);
     }
+}
+
+static void select_chapter_menu(mp_state *state, dyn_entry *item) {
+    mp_chapter_list *list = state->chapter_list;
+    if (list == NULL || list->num_entries == 0) return;
+
     if (state->chapter >= 0) {
         CheckMenuRadioItem(item->hmenu, 0, list->num_entries, state->chapter,
                            MF_BYPOSITION);
     }
+}
 
-    talloc_free(tmp);
+static char *chapter_page_label(mp_state *state, dyn_entry *item,
+                                mp_arena *a) {
+    mp_chapter_list *list = state->chapter_list;
+    double from = list->entries[item->page_start].time;
+    double to = list->entries[item->page_end - 1].time;
+    return arena_asprintf(a, "%02d:%02d:%02d - %02d:%02d:%02d",
+                          (int)from / 3600, (int)from / 60 % 60,
+                          (int)from % 60, (int)to / 3600, (int)to / 60 % 60,
+                          (int)to % 60);
 }
 
 static void update_edition_menu(mp_state *state, dyn_entry *item) {
     mp_edition_list *list = state->edition_list;
     if (list == NULL || list->num_entries == 0) return;
 
+    menu_builder mb;
+    mb_init(&mb, item->hmenu, &item->arena, list->num_entries);
+
     int pos = -1;
     for (int i = 0; i < list->num_entries; i++) {
         mp_edition_item *entry = &list->entries[i];
         if (entry->id == state->edition) pos = i;
-        append_menu(
-            item->hmenu, MIIM_STRING | MIIM_DATA, 0, 0,
-            escape_title(item->talloc_ctx, bstr0(entry->title)), NULL,
-            talloc_asprintf(item->talloc_ctx, "set edition %d", entry->id));
+        mb_append(
+            &mb, MIIM_STRING | MIIM_DATA, 0, 0,
+            escape_title(entry->title), NULL,
+            cmd_parse_arena(&item->arena,
+                            arena_asprintf(&item->arena,
+                                           "set edition %d", entry->id)));
     }
+    mb_flush(&mb);
+    item->num_items = mb.count;
+
     if (pos >= 0) {
         CheckMenuRadioItem(item->hmenu, 0, list->num_entries, pos,
                            MF_BYPOSITION);
     }
 }
 
+static void select_edition_menu(mp_state *state, dyn_entry *item) {
+    mp_edition_list *list = state->edition_list;
+    if (list == NULL || list->num_entries == 0) return;
+
+    for (int i = 0; i < list->num_entries; i++) {
+        if (list->entries[i].id != state->edition) continue;
+        CheckMenuRadioItem(item->hmenu, 0, list->num_entries, i,
+                           MF_BYPOSITION);
+        break;
+    }
+}
+
 static void update_audio_device_menu(mp_state *state, dyn_entry *item) {
     mp_audio_device_list *list = state->audio_device_list;
     if (list == NULL || list->num_entries == 0) return;
 
-    void *tmp = talloc_new(NULL);
+    int start = item->page_start;
+    int end = item->page_end > 0 ? item->page_end : list->num_entries;
+    if (end > list->num_entries) end = list->num_entries;
+    if (start >= end) return;
+
+    menu_builder mb;
+    mb_init(&mb, item->hmenu, &item->arena, end - start);
 
     char *name = state->audio_device;
     int pos = -1;
-    for (int i = 0; i < list->num_entries; i++) {
+    for (int i = start; i < end; i++) {
         mp_audio_device *entry = &list->entries[i];
-        if (strcmp(entry->name, name) == 0) pos = i;
-        char *title = entry->desc;
-        if (title == NULL || strlen(title) == 0)
-            title = talloc_strdup(tmp, entry->name);
-        append_menu(item->hmenu, MIIM_STRING | MIIM_DATA, 0, 0,
-                    escape_title(item->talloc_ctx, bstr0(title)), NULL,
-                    talloc_asprintf(item->talloc_ctx, "set audio-device %s",
-                                    entry->name));
+        if (strcmp(entry->name, name) == 0) pos = i - start;
+        bstr title = entry->desc;
+        if (title.len == 0) title = bstr0(entry->name);
+        mb_append(&mb, MIIM_STRING | MIIM_DATA, 0, 0,
+                  escape_title(title), NULL,
+                  cmd_parse_arena(&item->arena,
+                                  arena_asprintf(&item->arena,
+                                                 "set audio-device %s",
+                                                 entry->name)));
     }
+    mb_flush(&mb);
+    item->num_items = mb.count;
+
     if (pos >= 0) {
-        CheckMenuRadioItem(item->hmenu, 0, list->num_entries, pos,
+        CheckMenuRadioItem(item->hmenu, 0, end - start - 1, pos,
                            MF_BYPOSITION);
     }
+}
 
-    talloc_free(tmp);
+static void select_audio_device_menu(mp_state *state, dyn_entry *item) {
+    mp_audio_device_list *list = state->audio_device_list;
+    if (list == NULL || list->num_entries == 0) return;
+    if (state->audio_device == NULL) return;
+
+    for (int i = 0; i < list->num_entries; i++) {
+        if (strcmp(list->entries[i].name, state->audio_device) != 0) continue;
+        CheckMenuRadioItem(item->hmenu, 0, list->num_entries, i,
+                           MF_BYPOSITION);
+        break;
+    }
+}
+
+// cap the sibling entries materialized into the submenu, so a huge
+// directory cannot stall the popup
+#define FILE_MENU_MAX 1000
+
+static void update_playlist_menu(mp_state *state, dyn_entry *item) {
+    mp_playlist_list *list = state->playlist;
+    mp_file_list *files = state->file_list;
+    int num_playlist = list != NULL ? list->num_entries : 0;
+    int num_files = files != NULL ? files->num_entries : 0;
+    if (num_playlist == 0 && num_files == 0) return;
+
+    int max_files = num_files < FILE_MENU_MAX ? num_files : FILE_MENU_MAX;
+    menu_builder mb;
+    mb_init(&mb, item->hmenu, &item->arena, num_playlist + 1 + max_files);
+
+    for (int i = 0; i < num_playlist; i++) {
+        mp_playlist_item *entry = &list->entries[i];
+        mb_append(&mb, MIIM_STRING | MIIM_DATA, 0, 0,
+                  escape_title(entry->title), NULL,
+                  cmd_parse_arena(&item->arena,
+                                  arena_asprintf(&item->arena,
+                                                 "playlist-play-index %d",
+                                                 i)));
+    }
+
+    if (num_playlist > 0 && num_files > 0)
+        mb_append(&mb, MIIM_FTYPE, MFT_SEPARATOR, 0, NULL, NULL, NULL);
+
+    for (int i = 0; i < max_files; i++) {
+        bstr name = files->entries[i];
+        mb_append(&mb, MIIM_STRING | MIIM_DATA, 0, 0,
+                  escape_title(name), NULL,
+                  cmd_parse_arena(&item->arena,
+                                  arena_asprintf(&item->arena,
+                                                 "loadfile \"%s/%.*s\"",
+                                                 files->dir, BSTR_P(name))));
+    }
+
+    mb_flush(&mb);
+    item->num_items = mb.count;
+
+    if (state->playlist_pos >= 0 && state->playlist_pos < num_playlist) {
+        CheckMenuRadioItem(item->hmenu, 0, num_playlist - 1,
+                           state->playlist_pos, MF_BYPOSITION);
+    }
+}
+
+static void select_playlist_menu(mp_state *state, dyn_entry *item) {
+    mp_playlist_list *list = state->playlist;
+    if (list == NULL || list->num_entries == 0) return;
+
+    if (state->playlist_pos >= 0 &&
+        state->playlist_pos < list->num_entries) {
+        CheckMenuRadioItem(item->hmenu, 0, list->num_entries - 1,
+                           state->playlist_pos, MF_BYPOSITION);
+    }
+}
+
+static mp_state_gen *script_gen(mp_state *state, dyn_entry *item) {
+    return &script_find(item->keyword)->gen;
+}
+
+static int count_script(mp_state *state, dyn_entry *item) {
+    script_provider *sp = script_find(item->keyword);
+    return sp != NULL ? sp->num_items : 0;
+}
+
+static void update_script_menu(mp_state *state, dyn_entry *item) {
+    script_provider *sp = script_find(item->keyword);
+    if (sp == NULL || sp->num_items == 0) return;
+
+    menu_builder mb;
+    mb_init(&mb, item->hmenu, &item->arena, sp->num_items);
+
+    for (int i = 0; i < sp->num_items; i++) {
+        script_item *entry = &sp->items[i];
+        if (bstr_equals0(entry->title, "-")) {
+            mb_append(&mb, MIIM_FTYPE, MFT_SEPARATOR, 0, NULL, NULL, NULL);
+            continue;
+        }
+        mb_append(&mb, MIIM_STRING | MIIM_DATA, 0, 0,
+                  escape_title(entry->title), NULL,
+                  cmd_parse_arena(&item->arena,
+                                  arena_asprintf(&item->arena, "%.*s",
+                                                 BSTR_P(entry->cmd))));
+    }
+    mb_flush(&mb);
+    item->num_items = mb.count;
+}
+
+static void select_script_menu(mp_state *state, dyn_entry *item) {}
+
+bool menu_script_register(plugin_ctx *ctx, const char *keyword) {
+    menu_lock();
+    if (script_find(keyword) != NULL) {
+        menu_unlock();
+        return false;
+    }
+
+    script_provider *sp = talloc_zero(ctx, script_provider);
+    sp->keyword = talloc_strdup(sp, keyword);
+    MP_TARRAY_APPEND(ctx, scripts, num_scripts, sp);
+
+    dyn_provider_register((dyn_provider){sp->keyword, script_gen,
+                                         count_script, update_script_menu,
+                                         select_script_menu});
+    menu_unlock();
+    return true;
+}
+
+void menu_script_update(plugin_ctx *ctx, const char *keyword,
+                        const char **items, int num_items) {
+    menu_lock();
+    script_provider *sp = script_find(keyword);
+    if (sp == NULL) {
+        menu_unlock();
+        return;
+    }
+
+    size_t strings_len = 0;
+    for (int i = 0; i < num_items; i++)
+        strings_len += strlen(items[i]) + 1;
+
+    talloc_free(sp->items);
+    talloc_free(sp->strings);
+    sp->items = talloc_array(sp, script_item, num_items);
+    sp->strings = talloc_size(sp, strings_len);
+    sp->num_items = num_items;
+
+    char *p = sp->strings;
+    for (int i = 0; i < num_items; i++) {
+        size_t len = strlen(items[i]) + 1;
+        memcpy(p, items[i], len);
+
+        bstr title, cmd;
+        bstr_split_tok(bstr0(p), "\t", &title, &cmd);
+        sp->items[i] = (script_item){
+            .title = bstr_strip(title),
+            .cmd = bstr_strip(cmd),
+        };
+        p += len;
+    }
+    sp->gen.list++;
+    menu_unlock();
 }
 
 static void dyn_menu_init(void *talloc_ctx) {
     dyn_menus = talloc_zero(talloc_ctx, dyn_list);
+    unbound = NULL;
+    num_unbound = 0;
 }
 
-static void dyn_menu_update(plugin_ctx *ctx) {
-    if (dyn_menus == NULL) return;
+// pagination limit, taken from the plugin config at load time
+static int paginate_limit = 0;
 
+static dyn_entry *dyn_find(HMENU hmenu) {
     for (int i = 0; i < dyn_menus->num_entries; i++) {
-        dyn_entry *item = &dyn_menus->entries[i];
+        if (dyn_menus->entries[i].hmenu == hmenu)
+            return &dyn_menus->entries[i];
+    }
+    return NULL;
+}
 
-        // clear menu
-        while (GetMenuItemCount(item->hmenu) > 0)
-            RemoveMenu(item->hmenu, 0, MF_BYPOSITION);
-        talloc_free_children(item->talloc_ctx);
+// return an entry's command ids to the free list, dropping their command
+// slots so a stale WM_COMMAND cannot reach a freed command; page-submenu
+// ids never had a command slot, skip those so retiring cannot grow the
+// table
+static void dyn_ids_retire(dyn_entry *item) {
+    for (int i = 0; i < item->num_ids; i++) {
+        UINT id = item->ids[i];
+        if (cmd_table_get(id) != NULL) cmd_table_set(id, NULL);
+        draw_item_clear(id);
+        MP_TARRAY_APPEND(cmds, free_ids, num_free_ids, id);
+    }
+    item->num_ids = 0;
+}
 
-        item->update(ctx->state, item);
+// drop the page entries of a paginated submenu before it is rebuilt;
+// RemoveMenu() has already detached the page items from the parent
+static void dyn_pages_clear(HMENU parent) {
+    for (int i = dyn_menus->num_entries - 1; i >= 0; i--) {
+        dyn_entry *page = &dyn_menus->entries[i];
+        if (page->parent != parent) continue;
+        dyn_ids_retire(page);
+        talloc_free(page->ids);
+        DestroyMenu(page->hmenu);
+        talloc_free(page->arena.buf);
+        talloc_free(page->arena.overflow);
+        MP_TARRAY_REMOVE_AT(dyn_menus->entries, dyn_menus->num_entries, i);
+    }
+}
 
-        // update state
-        int count = GetMenuItemCount(item->hmenu);
-        UINT enable = count > 0 ? MF_ENABLED : MF_GRAYED;
-        EnableMenuItem(ctx->hmenu, item->id, MF_BYCOMMAND | enable);
+// above the limit, fill the submenu with page entries covering fixed
+// ranges of the list; each page materializes its items lazily on
+// WM_INITMENUPOPUP, so creation cost is O(page), not O(total)
+static bool paginate_menu(mp_state *state, dyn_entry *item) {
+    if (paginate_limit <= 0 || !item->pageable || item->page_end > 0)
+        return false;
+    int count = item->count(state, item);
+    if (count <= paginate_limit) return false;
+
+    // appending page entries may move the array the item lives in, so
+    // work on a copy and write the mutated fields back afterwards
+    dyn_entry parent = *item;
+    HMENU hmenu = item->hmenu;
+
+    int num_pages = (count + paginate_limit - 1) / paginate_limit;
+    menu_builder mb;
+    mb_init(&mb, parent.hmenu, &parent.arena, num_pages);
+
+    for (int p = 0; p < num_pages; p++) {
+        dyn_entry page = {
+            .hmenu = CreatePopupMenu(),
+            .parent = parent.hmenu,
+            .keyword = parent.keyword,
+            .seen = {UINT64_MAX, UINT64_MAX},
+            .page_start = p * paginate_limit,
+            .page_end = (p + 1) * paginate_limit < count
+                            ? (p + 1) * paginate_limit
+                            : count,
+            .gen = parent.gen,
+            .count = parent.count,
+            .update = parent.update,
+        };
+        arena_init(&page.arena, dyn_menus, 1024);
+
+        char *label =
+            parent.page_label != NULL
+                ? parent.page_label(state, &page, &parent.arena)
+                : arena_asprintf(&parent.arena, "%d - %d",
+                                 page.page_start + 1, page.page_end);
+        mb_append(&mb, MIIM_STRING | MIIM_SUBMENU, 0, 0,
+                  escape_title(bstr0(label)), page.hmenu, NULL);
+
+        MP_TARRAY_APPEND(dyn_menus, dyn_menus->entries,
+                         dyn_menus->num_entries, page);
     }
+    mb_flush(&mb);
+
+    item = dyn_find(hmenu);
+    item->arena = parent.arena;
+    item->num_items = mb.count;
+    return true;
+}
+
+// rebuild or patch a single dynamic submenu
+static void dyn_entry_update(plugin_ctx *ctx, HMENU hmenu) {
+    uint64_t perf = perf_start();
+    dyn_entry *item = dyn_find(hmenu);
+    if (item == NULL) return;
+
+    mp_state_gen *gen = item->gen(ctx->state, item);
+
+    // backing list unchanged: at most patch check states in place; page
+    // entries have no select callback and rebuild instead, their size is
+    // bounded by the page limit so that is just as cheap
+    if (gen->list == item->seen.list) {
+        bool select_dirty = gen->select != item->seen.select;
+        if (!select_dirty || item->select != NULL) {
+            // a paginated parent holds page items only, the check states
+            // live in the pages and update when one is popped up
+            if (select_dirty && !item->paged) item->select(ctx->state, item);
+            item->seen = *gen;
+            perf_end(PERF_PHASE_UPDATE, perf);
+            return;
+        }
+    }
+
+    // clear menu; the arena reset keeps its high-water-mark capacity, so
+    // a steady-state rebuild allocates nothing
+    dyn_ids_retire(item);
+    for (int n = item->num_items; n > 0; n--)
+        RemoveMenu(item->hmenu, 0, MF_BYPOSITION);
+    item->num_items = 0;
+    arena_reset(&item->arena);
+    if (item->paged) {
+        dyn_pages_clear(hmenu);
+        item = dyn_find(hmenu);
+    }
+
+    collecting = true;
+    num_collect = 0;
+    bool paged = paginate_menu(ctx->state, item);
+    item = dyn_find(hmenu);
+    if (!paged) item->update(ctx->state, item);
+    collecting = false;
+
+    item->ids = talloc_realloc(dyn_menus, item->ids, UINT, num_collect);
+    if (num_collect > 0)
+        memcpy(item->ids, collect_ids, num_collect * sizeof(UINT));
+    item->num_ids = num_collect;
+    item->paged = paged;
+    item->seen = *item->gen(ctx->state, item);
+    perf_end(PERF_PHASE_UPDATE, perf);
+}
+
+// refresh the gray state of the dynamic submenu entries, the content itself
+// is materialized by handle_init_menu() when a submenu is about to display
+void dyn_menu_update(plugin_ctx *ctx) {
+    menu_lock();
+    if (dyn_menus != NULL) {
+        for (int i = 0; i < dyn_menus->num_entries; i++) {
+            dyn_entry *item = &dyn_menus->entries[i];
+            if (item->parent != NULL) continue;  // page entries have no id
+            UINT enable =
+                item->count(ctx->state, item) > 0 ? MF_ENABLED : MF_GRAYED;
+            EnableMenuItem(ctx->hmenu, item->id, MF_BYCOMMAND | enable);
+        }
+    }
+    menu_unlock();
+}
+
+// update a dynamic submenu right before it is displayed
+void handle_init_menu(plugin_ctx *ctx, HMENU hmenu) {
+    menu_lock();
+    if (dyn_menus != NULL) dyn_entry_update(ctx, hmenu);
+    menu_unlock();
 }
 
 static bool is_seprarator(bstr text, bool uosc) {
@@ -319,7 +1344,7 @@ static void parse_menu(void *talloc_ctx, HMENU hmenu, bstr key, bstr cmd,
             int id = 0;
             if (bstr_eatstart0(&comment, MENU_PREFIX_DYN)) {
                 HMENU submenu =
-                    append_submenu(hmenu, escape_title(talloc_ctx, name), &id);
+                    append_submenu(hmenu, escape_title(name), &id);
                 if (id > 0 && comment.len > 0) {
                     bstr keyword = bstr_split(comment, "#", NULL);
                     keyword = bstr_rstrip(keyword);
@@ -327,15 +1352,16 @@ static void parse_menu(void *talloc_ctx, HMENU hmenu, bstr key, bstr cmd,
                 }
             } else {
                 id = append_menu(hmenu, MIIM_STRING | MIIM_DATA, 0, 0,
-                                 format_title(talloc_ctx, name, key), NULL,
-                                 bstrdup0(talloc_ctx, cmd));
+                                 format_title(name, key), NULL,
+                                 menu_cmd_parse(talloc_ctx,
+                                                bstrdup0(talloc_ctx, cmd)));
                 if (id > 0 && (!cmd.len || bstr_startswith0(cmd, "#")))
                     EnableMenuItem(hmenu, id, MF_BYCOMMAND | MF_GRAYED);
             }
         }
     } else {
         HMENU submenu =
-            append_submenu(hmenu, escape_title(talloc_ctx, name), NULL);
+            append_submenu(hmenu, escape_title(name), NULL);
         if (!comment.len) parse_menu(talloc_ctx, submenu, key, cmd, rest, uosc);
     }
 }
@@ -351,57 +1377,310 @@ static bool split_menu(bstr line, bstr *left, bstr *right, bool uosc) {
     return right->len > 0;
 }
 
-HMENU load_menu(plugin_ctx *ctx) {
-    dyn_menu_init(ctx);
+// process a single line of menu config data
+static void parse_line(plugin_ctx *ctx, HMENU hmenu, bstr line) {
+    line = bstr_lstrip(line);
+    if (!line.len) return;
+
+    bstr key, cmd, left, right;
+    if (bstr_eatstart0(&line, "#")) {
+        if (!ctx->conf->uosc) return;
+        key = bstr0(NULL);
+        cmd = bstr_strip(line);
+    } else {
+        key = bstr_split(line, WHITESPACE, &cmd);
+        cmd = bstr_strip(cmd);
+    }
+    if (split_menu(cmd, &left, &right, ctx->conf->uosc))
+        parse_menu(menu_ctx, hmenu, key, cmd, right, ctx->conf->uosc);
+}
+
+// a menu config fragment pulled in with the include directive
+typedef struct {
+    char *path;        // fragment file path
+    char *data;        // file content, filled in by the reader thread
+    void *talloc_ctx;  // fragment context, owned by the thread until joined
+    mp_thread thread;  // reader thread, NULL if the read ran synchronously
+} menu_fragment;
+
+typedef struct {
+    menu_fragment *entries;
+    int num_entries;
+    int *counts;  // fragments matched per include directive, in order
+    int num_counts;
+} fragment_list;
+
+static MP_THREAD_VOID fragment_read_thread(void *ptr) {
+    menu_fragment *frag = ptr;
+    frag->data = mp_read_file(frag->talloc_ctx, frag->path);
+    MP_THREAD_RETURN();
+}
+
+static bool split_include(bstr line, bstr *pattern) {
+    if (!bstr_eatstart0(&line, MENU_PREFIX_INCLUDE)) return false;
+    *pattern = bstr_strip(line);
+    return pattern->len > 0;
+}
+
+static int fragment_cmp(const void *a, const void *b) {
+    return strcmp(((const menu_fragment *)a)->path,
+                  ((const menu_fragment *)b)->path);
+}
+
+// expand one include directive, globs match files in a single directory
+static void add_fragments(void *talloc_ctx, fragment_list *frags,
+                          bstr pattern) {
+    int before = frags->num_entries;
+    char *pat = bstrdup0(talloc_ctx, pattern);
+
+    if (strpbrk(pat, "*?") == NULL) {
+        menu_fragment frag = {.path = pat,
+                              .talloc_ctx = talloc_new(talloc_ctx)};
+        MP_TARRAY_APPEND(talloc_ctx, frags->entries, frags->num_entries, frag);
+    } else {
+        void *tmp = talloc_new(NULL);
+        char *expanded = mp_expand_path(tmp, pat);
+        char *sep = strrchr(expanded, '/');
+        char *sep2 = strrchr(expanded, '\\');
+        if (sep2 > sep) sep = sep2;
+        char *dir = sep != NULL
+                        ? talloc_strndup(tmp, expanded, sep - expanded)
+                        : talloc_strdup(tmp, ".");
+
+        WIN32_FIND_DATAW fd;
+        HANDLE hFind = FindFirstFileW(mp_from_utf8(tmp, expanded), &fd);
+        if (hFind != INVALID_HANDLE_VALUE) {
+            do {
+                if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+                menu_fragment frag = {
+                    .path = talloc_asprintf(talloc_ctx, "%s/%s", dir,
+                                            mp_to_utf8(tmp, fd.cFileName)),
+                    .talloc_ctx = talloc_new(talloc_ctx),
+                };
+                MP_TARRAY_APPEND(talloc_ctx, frags->entries,
+                                 frags->num_entries, frag);
+            } while (FindNextFileW(hFind, &fd));
+            FindClose(hFind);
+        }
+        talloc_free(tmp);
+
+        // directory listing order is not defined, sort for a stable menu
+        qsort(&frags->entries[before], frags->num_entries - before,
+              sizeof(menu_fragment), fragment_cmp);
+    }
+
+    MP_TARRAY_APPEND(talloc_ctx, frags->counts, frags->num_counts,
+                     frags->num_entries - before);
+}
+
+// heap accounting for the module-local tables, reported by mem.c; arena
+// backing blocks live outside their dyn_entry, so they are summed in
+int menu_mem_stats(mem_stat *stats, int max) {
+    int n = 0;
+    if (dyn_menus != NULL && n < max) {
+        stats[n] = (mem_stat){.name = "dynamic"};
+        stats[n].bytes = talloc_total_size(dyn_menus, &stats[n].allocs);
+        for (int i = 0; i < dyn_menus->num_entries; i++) {
+            mp_arena *a = &dyn_menus->entries[i].arena;
+            stats[n].bytes += talloc_get_size(a->buf) +
+                              talloc_total_size(a->overflow, &stats[n].allocs);
+            stats[n].allocs++;
+        }
+        n++;
+    }
+    if (titles != NULL && n < max) {
+        stats[n] = (mem_stat){.name = "titles"};
+        stats[n].bytes = talloc_total_size(titles, &stats[n].allocs);
+        n++;
+    }
+    if (submenus != NULL && n < max) {
+        stats[n] = (mem_stat){.name = "index"};
+        stats[n].bytes = talloc_total_size(submenus, &stats[n].allocs);
+        n++;
+    }
+    if (cmds != NULL && n < max) {
+        stats[n] = (mem_stat){.name = "commands"};
+        stats[n].bytes = talloc_total_size(cmds, &stats[n].allocs);
+        n++;
+    }
+    if (num_scripts > 0 && n < max) {
+        stats[n] = (mem_stat){.name = "scripts"};
+        for (int i = 0; i < num_scripts; i++)
+            stats[n].bytes += talloc_total_size(scripts[i], &stats[n].allocs);
+        n++;
+    }
+    return n;
+}
+
+// reclaim what only exists to make rebuilds cheap: the caches regrow on
+// demand and the table slack reaccumulates, so the cost is one slower
+// rebuild after the sweep. The dyn arenas are left alone, their blocks
+// hold the live item commands and cannot move
+void menu_compact(void) {
+    if (titles != NULL) {
+        talloc_free_children(titles);
+        titles->size = 256;
+        titles->used = 0;
+        titles->entries =
+            talloc_zero_array(titles, title_cache_entry, titles->size);
+    }
+    if (scratch_buf != NULL && talloc_get_size(scratch_buf) > 256)
+        scratch_buf = talloc_realloc_size(NULL, scratch_buf, 256);
+    if (cmds != NULL && cmds->entries != NULL) {
+        cmds->entries = talloc_realloc(cmds, cmds->entries, menu_cmd *,
+                                       cmds->num_entries);
+    }
+    if (dyn_menus != NULL && dyn_menus->entries != NULL) {
+        dyn_menus->entries = talloc_realloc(dyn_menus, dyn_menus->entries,
+                                            dyn_entry, dyn_menus->num_entries);
+    }
+    draw_compact();
+}
+
+static HMENU load_menu_unlocked(plugin_ctx *ctx) {
+    uint64_t perf = perf_start();
+
+    // ids restart on every (re)load so repeated config reloads cannot run
+    // past the 16 bits WM_COMMAND delivers
+    next_menu_id = WM_USER + 100;
+    paginate_limit = ctx->conf->paginate;
+
+    // the registry persists across reloads, script registrations survive
+    if (registry_ctx == NULL) {
+        registry_ctx = ctx;
+        for (int i = 0; i < ARRAYSIZE(dyn_builtins); i++)
+            dyn_provider_register(dyn_builtins[i]);
+    }
+
+    talloc_free(menu_ctx);
+    menu_ctx = talloc_new(ctx);
+
+    dyn_menu_init(menu_ctx);
+    submenu_index_init(menu_ctx);
+    title_cache_init(menu_ctx);
+    cmd_table_init(menu_ctx);
+    scratch_init(menu_ctx);
+    draw_init(ctx, menu_ctx);
 
     void *tmp = talloc_new(NULL);
-    char *path = mp_get_prop_string(tmp, "input-conf");
+    char *path = ctx->input_conf;
+    if (path == NULL) path = mp_get_prop_string(tmp, "input-conf");
     if (path == NULL || strlen(path) == 0) path = "~~/input.conf";
 
-    HMENU hmenu = CreatePopupMenu();
-    bstr data = bstr0(mp_read_file(tmp, path));
+    // shared mode: map the blob published by another running instance
+    if (ctx->conf->shared) {
+        HMENU shared = menu_shared_load(ctx, path);
+        if (shared != NULL) {
+            talloc_free(tmp);
+            perf_end(PERF_PHASE_LOAD, perf);
+            return shared;
+        }
+    }
+
+    // build straight from the compiled cache if it matches the source
+    HMENU hmenu = menu_cache_load(ctx, path);
+    if (hmenu != NULL) {
+        if (ctx->conf->shared) menu_shared_publish(ctx, path, hmenu);
+        talloc_free(tmp);
+        perf_end(PERF_PHASE_LOAD, perf);
+        return hmenu;
+    }
+
+    hmenu = CreatePopupMenu();
+    mp_file_map map;
+    bstr data = bstr0(NULL);
+    if (mp_map_file(&map, tmp, path)) data = map.data;
 
+    // scan for include directives up front so the fragment reads run in
+    // parallel with parsing the main file
+    fragment_list frags = {0};
+    bstr rest = data;
+    while (rest.len > 0) {
+        bstr line = bstr_strip_linebreaks(mp_scan_getline(rest, &rest));
+        bstr pattern;
+        if (split_include(bstr_lstrip(line), &pattern))
+            add_fragments(tmp, &frags, pattern);
+    }
+    for (int i = 0; i < frags.num_entries; i++) {
+        menu_fragment *frag = &frags.entries[i];
+        if (mp_thread_create(&frag->thread, fragment_read_thread, frag) != 0) {
+            frag->thread = NULL;
+            frag->data = mp_read_file(frag->talloc_ctx, frag->path);
+        }
+    }
+
+    int next_frag = 0, directive = 0;
     while (data.len > 0) {
-        bstr line = bstr_strip_linebreaks(bstr_getline(data, &data));
-        line = bstr_lstrip(line);
-        if (!line.len) continue;
-
-        bstr key, cmd, left, right;
-        if (bstr_eatstart0(&line, "#")) {
-            if (!ctx->conf->uosc) continue;
-            key = bstr0(NULL);
-            cmd = bstr_strip(line);
-        } else {
-            key = bstr_split(line, WHITESPACE, &cmd);
-            cmd = bstr_strip(cmd);
+        bstr line = bstr_strip_linebreaks(mp_scan_getline(data, &data));
+        bstr pattern;
+        if (split_include(bstr_lstrip(line), &pattern)) {
+            // splice the fragments of this directive in declaration order
+            for (int n = frags.counts[directive++]; n > 0; n--) {
+                menu_fragment *frag = &frags.entries[next_frag++];
+                if (frag->thread != NULL) mp_thread_join(frag->thread);
+                bstr fdata = bstr0(frag->data);
+                while (fdata.len > 0) {
+                    bstr fline = mp_scan_getline(fdata, &fdata);
+                    parse_line(ctx, hmenu, bstr_strip_linebreaks(fline));
+                }
+                talloc_free_children(frag->talloc_ctx);
+            }
+            continue;
         }
-        if (split_menu(cmd, &left, &right, ctx->conf->uosc))
-            parse_menu(ctx, hmenu, key, cmd, right, ctx->conf->uosc);
+        parse_line(ctx, hmenu, line);
     }
 
+    // the compiled cache is keyed on the main file alone, skip it (and the
+    // shared section) when include fragments contributed to the tree
+    if (frags.num_counts == 0) {
+        menu_cache_save(ctx, path, hmenu);
+        if (ctx->conf->shared) menu_shared_publish(ctx, path, hmenu);
+    }
+    mp_unmap_file(&map);
+
     talloc_free(tmp);
 
+    perf_end(PERF_PHASE_LOAD, perf);
+    return hmenu;
+}
+
+HMENU load_menu(plugin_ctx *ctx) {
+    menu_lock();
+    HMENU hmenu = load_menu_unlocked(ctx);
+    menu_unlock();
     return hmenu;
 }
 
 void show_menu(plugin_ctx *ctx, POINT *pt) {
+    uint64_t perf = perf_start();
+
     RECT rc;
     GetClientRect(ctx->hwnd, &rc);
     ScreenToClient(ctx->hwnd, pt);
     if (!PtInRect(&rc, *pt)) return;
 
-    dyn_menu_update(ctx);
-
     ClientToScreen(ctx->hwnd, pt);
+
+    // the popup itself blocks until dismissed, only time the lead-up
+    perf_end(PERF_PHASE_SHOW, perf);
     TrackPopupMenuEx(ctx->hmenu, TPM_LEFTALIGN | TPM_LEFTBUTTON, pt->x, pt->y,
                      ctx->hwnd, NULL);
 }
 
 void handle_menu(plugin_ctx *ctx, int id) {
-    MENUITEMINFOW mii = {0};
-    mii.cbSize = sizeof(mii);
-    mii.fMask = MIIM_DATA;
-    if (!GetMenuItemInfoW(ctx->hmenu, id, FALSE, &mii)) return;
-
-    if (mii.dwItemData) mp_command_async((const char *)mii.dwItemData);
+    uint64_t perf = perf_start();
+
+    menu_lock();
+    menu_cmd *cmd = cmd_table_get(id);
+    if (cmd != NULL) {
+        if (cmd->args != NULL) {
+            // tokenized at build time: no parsing at click time, and the
+            // async command API is safe to call from the window thread
+            mpv_command_async(ctx->mpv, 0, (const char **)cmd->args);
+        } else {
+            mp_command_async(cmd->text);
+        }
+        perf_end(PERF_PHASE_HANDLE, perf);
+    }
+    menu_unlock();
 }
\ No newline at end of file
@@ -6,10 +6,44 @@
 
 #include <windows.h>
 #include <mpv/client.h>
+#include "misc/bstr.h"
+#include "mem.h"
 #include "plugin.h"
 
+// a menu item command, tokenized once at menu build time
+typedef struct {
+    char *text;   // original command string
+    char **args;  // NULL-terminated argv, NULL if the text needs parsing
+} menu_cmd;
+
 HMENU load_menu(plugin_ctx *ctx);
 void show_menu(plugin_ctx *ctx, POINT *pt);
 void handle_menu(plugin_ctx *ctx, int id);
+void handle_init_menu(plugin_ctx *ctx, HMENU hmenu);
+void dyn_menu_update(plugin_ctx *ctx);
+
+// script-provided dynamic submenus, registered and fed via script-message
+bool menu_script_register(plugin_ctx *ctx, const char *keyword);
+void menu_script_update(plugin_ctx *ctx, const char *keyword,
+                        const char **items, int num_items);
+
+// menu table lock, shared by the window thread and the mpv thread; the
+// entry points above take it themselves, menu_mem_stats/menu_compact
+// expect the caller to hold it (mem.c locks around the whole sweep)
+void menu_lock(void);
+void menu_unlock(void);
+
+// heap accounting and compaction of the menu tables, driven by mem.c
+int menu_mem_stats(mem_stat *stats, int max);
+void menu_compact(void);
+
+// internal helpers shared with the compiled menu cache (cache.c)
+void *menu_gen_ctx(void);
+int append_menu(HMENU hmenu, UINT fMask, UINT fType, UINT fState,
+                wchar_t *title, HMENU submenu, void *data);
+int append_seprator(HMENU hmenu);
+menu_cmd *menu_cmd_parse(void *talloc_ctx, char *text);
+bool add_dyn_menu(void *talloc_ctx, HMENU hmenu, int id, bstr keyword);
+char *dyn_menu_keyword(HMENU hmenu);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,107 @@
+// Copyright (c) 2023 tsl0922. All rights reserved.
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <windows.h>
+#include "mpv_talloc.h"
+#include "perf.h"
+
+// log2 timing histograms for the popup hot phases; recording a sample is
+// one counter read and a handful of plain stores, racy cross-thread
+// increments only skew the advisory stats
+
+#define PERF_BUCKETS 32
+
+typedef struct {
+    uint32_t buckets[PERF_BUCKETS];  // bucket i counts samples of ~2^i us
+    uint64_t count;
+    uint64_t total_us;
+    uint64_t max_us;
+} perf_hist;
+
+static perf_hist phases[PERF_PHASE_COUNT];
+
+static const char *phase_names[PERF_PHASE_COUNT] = {
+    [PERF_PHASE_LOAD] = "load",
+    [PERF_PHASE_UPDATE] = "update",
+    [PERF_PHASE_SHOW] = "show",
+    [PERF_PHASE_HANDLE] = "handle",
+};
+
+static uint64_t perf_freq() {
+    static uint64_t freq = 0;
+    if (freq == 0) {
+        LARGE_INTEGER li;
+        QueryPerformanceFrequency(&li);
+        freq = li.QuadPart;
+    }
+    return freq;
+}
+
+uint64_t perf_start() {
+    LARGE_INTEGER li;
+    QueryPerformanceCounter(&li);
+    return li.QuadPart;
+}
+
+void perf_end(perf_phase phase, uint64_t start) {
+    uint64_t us = (perf_start() - start) * 1000000 / perf_freq();
+    perf_hist *hist = &phases[phase];
+
+    int b = 0;
+    for (uint64_t v = us; v > 1 && b < PERF_BUCKETS - 1; v >>= 1) b++;
+
+    hist->buckets[b]++;
+    hist->count++;
+    hist->total_us += us;
+    if (us > hist->max_us) hist->max_us = us;
+}
+
+// publish the histograms to user-data/menu/perf as a node map, so an OSD
+// dashboard script can read them with mp.get_property_native()
+void perf_publish(mpv_handle *mpv) {
+    void *tmp = talloc_new(NULL);
+
+    mpv_node_list *list = talloc_zero(tmp, mpv_node_list);
+    list->num = PERF_PHASE_COUNT;
+    list->keys = talloc_array(tmp, char *, list->num);
+    list->values = talloc_zero_array(tmp, mpv_node, list->num);
+
+    for (int i = 0; i < PERF_PHASE_COUNT; i++) {
+        perf_hist *hist = &phases[i];
+
+        mpv_node_list *buckets = talloc_zero(tmp, mpv_node_list);
+        buckets->num = PERF_BUCKETS;
+        buckets->values = talloc_zero_array(tmp, mpv_node, buckets->num);
+        for (int j = 0; j < PERF_BUCKETS; j++) {
+            buckets->values[j] = (mpv_node){.format = MPV_FORMAT_INT64,
+                                            .u.int64 = hist->buckets[j]};
+        }
+
+        mpv_node_list *entry = talloc_zero(tmp, mpv_node_list);
+        entry->num = 4;
+        entry->keys = talloc_array(tmp, char *, entry->num);
+        entry->values = talloc_zero_array(tmp, mpv_node, entry->num);
+        entry->keys[0] = "count";
+        entry->values[0] = (mpv_node){.format = MPV_FORMAT_INT64,
+                                      .u.int64 = hist->count};
+        entry->keys[1] = "avg_us";
+        entry->values[1] = (mpv_node){
+            .format = MPV_FORMAT_INT64,
+            .u.int64 = hist->count > 0 ? hist->total_us / hist->count : 0};
+        entry->keys[2] = "max_us";
+        entry->values[2] = (mpv_node){.format = MPV_FORMAT_INT64,
+                                      .u.int64 = hist->max_us};
+        entry->keys[3] = "buckets";
+        entry->values[3] =
+            (mpv_node){.format = MPV_FORMAT_NODE_ARRAY, .u.list = buckets};
+
+        list->keys[i] = (char *)phase_names[i];
+        list->values[i] =
+            (mpv_node){.format = MPV_FORMAT_NODE_MAP, .u.list = entry};
+    }
+
+    mpv_node node = {.format = MPV_FORMAT_NODE_MAP, .u.list = list};
+    mpv_set_property(mpv, "user-data/menu/perf", MPV_FORMAT_NODE, &node);
+
+    talloc_free(tmp);
+}
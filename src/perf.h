@@ -0,0 +1,23 @@
+// Copyright (c) 2023 tsl0922. All rights reserved.
+// SPDX-License-Identifier: GPL-2.0-only
+
+#ifndef MPV_PLUGIN_PERF_H
+#define MPV_PLUGIN_PERF_H
+
+#include <stdint.h>
+#include <mpv/client.h>
+
+// instrumented hot phases
+typedef enum {
+    PERF_PHASE_LOAD,    // load_menu() config parse / cache replay
+    PERF_PHASE_UPDATE,  // dynamic submenu update before display
+    PERF_PHASE_SHOW,    // show_menu() up to TrackPopupMenuEx()
+    PERF_PHASE_HANDLE,  // handle_menu() click to command dispatch
+    PERF_PHASE_COUNT,
+} perf_phase;
+
+uint64_t perf_start(void);
+void perf_end(perf_phase phase, uint64_t start);
+void perf_publish(mpv_handle *mpv);
+
+#endif
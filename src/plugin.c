@@ -1,13 +1,19 @@
 // Copyright (c) 2023 tsl0922. All rights reserved.
 // SPDX-License-Identifier: GPL-2.0-only
 
+#include <stdatomic.h>
+
 #include <windows.h>
 #include <windowsx.h>
 #include <shlwapi.h>
 #include <mpv/client.h>
 #include "misc/bstr.h"
 #include "misc/ctype.h"
+#include "osdep/threads.h"
+#include "draw.h"
+#include "mem.h"
 #include "menu.h"
+#include "perf.h"
 #include "plugin.h"
 
 // global plugin context
@@ -15,16 +21,293 @@ plugin_ctx *ctx = NULL;
 
 #define WM_SHOWMENU (WM_USER + 1)
 
+// reply_userdata of the startup input-conf prefetch
+#define REPLY_INPUT_CONF 1
+
+// bounded MPSC command ring, so a burst of menu commands costs a single
+// wakeup and no dispatch mutex round trip per command
+#define CMD_RING_SIZE 256  // power of two
+
+typedef struct {
+    atomic_int_fast64_t seq;  // cell sequence number
+    const char *cmd;          // command string
+    bool owned;               // consumer frees the string after submitting
+} cmd_cell;
+
+typedef struct {
+    cmd_cell cells[CMD_RING_SIZE];
+    atomic_int_fast64_t head;  // consumer position
+    atomic_int_fast64_t tail;  // producer position
+    atomic_bool notified;      // a wakeup is pending for the current burst
+} cmd_ring;
+
+static cmd_ring commands;
+
+static void cmd_ring_init() {
+    for (int i = 0; i < CMD_RING_SIZE; i++)
+        atomic_init(&commands.cells[i].seq, i);
+}
+
+static bool cmd_ring_push(const char *cmd, bool owned) {
+    int_fast64_t pos =
+        atomic_load_explicit(&commands.tail, memory_order_relaxed);
+    cmd_cell *cell;
+
+    for (;;) {
+        cell = &commands.cells[pos & (CMD_RING_SIZE - 1)];
+        int_fast64_t seq =
+            atomic_load_explicit(&cell->seq, memory_order_acquire);
+        if (seq == pos) {
+            if (atomic_compare_exchange_weak_explicit(
+                    &commands.tail, &pos, pos + 1, memory_order_relaxed,
+                    memory_order_relaxed))
+                break;
+        } else if (seq < pos) {
+            return false;  // ring is full
+        } else {
+            pos = atomic_load_explicit(&commands.tail, memory_order_relaxed);
+        }
+    }
+
+    cell->cmd = cmd;
+    cell->owned = owned;
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+
+    // one wakeup per burst: only the first producer after a drain pays it
+    if (!atomic_exchange(&commands.notified, true)) mpv_wakeup(ctx->mpv);
+    return true;
+}
+
+// drain the ring on the mpv thread, submitting commands back-to-back
+static void cmd_ring_drain(mpv_handle *mpv) {
+    atomic_store(&commands.notified, false);
+
+    int_fast64_t pos =
+        atomic_load_explicit(&commands.head, memory_order_relaxed);
+    for (;;) {
+        cmd_cell *cell = &commands.cells[pos & (CMD_RING_SIZE - 1)];
+        int_fast64_t seq =
+            atomic_load_explicit(&cell->seq, memory_order_acquire);
+        if (seq < pos + 1) break;  // ring is empty
+        mpv_command_string(mpv, cell->cmd);
+        if (cell->owned) talloc_free((void *)cell->cmd);
+        atomic_store_explicit(&cell->seq, pos + CMD_RING_SIZE,
+                              memory_order_release);
+        pos++;
+    }
+    atomic_store_explicit(&commands.head, pos, memory_order_relaxed);
+}
+
+// config hot-reload: a watcher thread observes the directory holding the
+// menu config and queues a rebuild on the mpv thread when the file changes
+typedef struct {
+    char *path;     // config path, as understood by load_menu
+    wchar_t *file;  // file name to match in change notifications
+    HANDLE hdir;    // watched directory handle
+    HANDLE hstop;   // event signaled to stop the watcher
+    mp_thread thread;
+    bool running;
+} menu_watch;
+
+static menu_watch watch;
+
+static atomic_bool menu_shown;      // popup currently on screen
+static atomic_bool reload_pending;  // reload deferred while the popup was up
+static uint64_t menu_src_hash;      // content hash of the loaded config
+
+static void menu_reload_fn(void *data);
+
+static void menu_reload_queue() {
+    mp_dispatch_enqueue(ctx->dispatch, menu_reload_fn, ctx);
+}
+
+// rebuild the menu even if the config content is unchanged, used when a
+// script registers a keyword the last parse did not know about
+static void menu_reload_force() {
+    menu_src_hash = 0;
+    menu_reload_queue();
+}
+
+static void menu_reload_fn(void *data) {
+    plugin_ctx *ctx = data;
+    if (ctx->hmenu == NULL) return;
+
+    // swapping under an open popup would pull the tree out from under the
+    // window thread, retry once it is dismissed
+    if (atomic_load(&menu_shown)) {
+        atomic_store(&reload_pending, true);
+        return;
+    }
+
+    // editors fire several notifications per save: hash the content and
+    // skip the rebuild when it matches what is already loaded
+    void *tmp = talloc_new(NULL);
+    mp_file_map map;
+    uint64_t hash = 0;
+    if (mp_map_file(&map, tmp, watch.path)) {
+        hash = 0xcbf29ce484222325ULL;
+        for (size_t i = 0; i < map.data.len; i++)
+            hash = (hash ^ map.data.start[i]) * 0x100000001b3ULL;
+        mp_unmap_file(&map);
+    }
+    talloc_free(tmp);
+    if (hash != 0 && hash == menu_src_hash) return;
+    menu_src_hash = hash;
+
+    // build the replacement tree fully before swapping; the previous menu
+    // stays alive for one more generation in case the window thread still
+    // holds a reference from a message in flight
+    HMENU hmenu = load_menu(ctx);
+    if (ctx->hmenu_old != NULL) DestroyMenu(ctx->hmenu_old);
+    ctx->hmenu_old = ctx->hmenu;
+    ctx->hmenu = hmenu;
+    dyn_menu_update(ctx);
+}
+
+static MP_THREAD_VOID menu_watch_thread(void *ptr) {
+    DWORD buf[1024];
+    OVERLAPPED ov = {0};
+    ov.hEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+    HANDLE handles[2] = {watch.hstop, ov.hEvent};
+
+    for (;;) {
+        if (!ReadDirectoryChangesW(watch.hdir, buf, sizeof(buf), FALSE,
+                                   FILE_NOTIFY_CHANGE_FILE_NAME |
+                                       FILE_NOTIFY_CHANGE_SIZE |
+                                       FILE_NOTIFY_CHANGE_LAST_WRITE,
+                                   NULL, &ov, NULL))
+            break;
+        if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) !=
+            WAIT_OBJECT_0 + 1) {
+            CancelIoEx(watch.hdir, &ov);
+            break;
+        }
+
+        DWORD n = 0;
+        if (!GetOverlappedResult(watch.hdir, &ov, &n, TRUE)) break;
+
+        bool hit = n == 0;  // notification buffer overflowed, assume a hit
+        FILE_NOTIFY_INFORMATION *fni = (FILE_NOTIFY_INFORMATION *)buf;
+        while (n > 0) {
+            size_t len = fni->FileNameLength / sizeof(wchar_t);
+            if (_wcsnicmp(fni->FileName, watch.file, len) == 0 &&
+                watch.file[len] == L'\0')
+                hit = true;
+            if (fni->NextEntryOffset == 0) break;
+            fni = (FILE_NOTIFY_INFORMATION *)((char *)fni +
+                                              fni->NextEntryOffset);
+        }
+        if (hit) menu_reload_queue();
+    }
+
+    CloseHandle(ov.hEvent);
+    MP_THREAD_RETURN();
+}
+
+// start watching the directory of the menu config for edits
+static void menu_watch_start() {
+    void *tmp = talloc_new(NULL);
+    char *path = ctx->input_conf;
+    if (path == NULL) path = mp_get_prop_string(tmp, "input-conf");
+    if (path == NULL || strlen(path) == 0) path = "~~/input.conf";
+    if (bstr_startswith0(bstr0(path), "memory://")) {
+        talloc_free(tmp);
+        return;
+    }
+    watch.path = talloc_strdup(ctx, path);
+
+    char *expanded = mp_expand_path(tmp, path);
+    char *sep = strrchr(expanded, '/');
+    char *sep2 = strrchr(expanded, '\\');
+    if (sep2 > sep) sep = sep2;
+    char *dir = sep != NULL ? talloc_strndup(tmp, expanded, sep - expanded)
+                            : talloc_strdup(tmp, ".");
+    char *file = sep != NULL ? sep + 1 : expanded;
+
+    watch.file = mp_from_utf8(ctx, file);
+    watch.hdir = CreateFileW(
+        mp_from_utf8(tmp, dir), FILE_LIST_DIRECTORY,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+        OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
+        NULL);
+    talloc_free(tmp);
+    if (watch.hdir == INVALID_HANDLE_VALUE) return;
+
+    watch.hstop = CreateEventW(NULL, TRUE, FALSE, NULL);
+    watch.running =
+        mp_thread_create(&watch.thread, menu_watch_thread, NULL) == 0;
+    if (!watch.running) {
+        CloseHandle(watch.hdir);
+        CloseHandle(watch.hstop);
+    }
+}
+
+static void menu_watch_stop() {
+    if (!watch.running) return;
+    SetEvent(watch.hstop);
+    mp_thread_join(watch.thread);
+    CloseHandle(watch.hdir);
+    CloseHandle(watch.hstop);
+    watch.running = false;
+}
+
+// deferred menu build: the startup prefetch only records the config
+// path, the actual parse + HMENU construction runs on the plugin thread
+// once the event loop has been quiet for a moment, or on the first
+// WM_SHOWMENU, whichever comes first — sessions that never open the
+// menu never pay for building it
+#define MENU_BUILD_IDLE 0.1  // seconds of quiet before the idle build
+
+static bool menu_deferred = false;        // a build is still owed
+static atomic_bool menu_show_pending;     // re-post WM_SHOWMENU when built
+
+static void menu_build_fn(void *data) {
+    plugin_ctx *ctx = data;
+    if (ctx->hmenu == NULL) {
+        ctx->hmenu = load_menu(ctx);
+        // the startup property bursts were flushed while the build was
+        // still deferred, apply the gray states they would have set
+        dyn_menu_update(ctx);
+    }
+    menu_deferred = false;
+    if (atomic_exchange(&menu_show_pending, false) && ctx->hwnd != NULL)
+        PostMessageW(ctx->hwnd, WM_SHOWMENU, 0, 0);
+}
+
 LRESULT CALLBACK WndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
     POINT pt;
 
     switch (uMsg) {
         case WM_SHOWMENU:
-            if (GetCursorPos(&pt)) show_menu(ctx, &pt);
+            if (ctx->hmenu == NULL) {
+                // first click won the race against the idle build: build
+                // now on the plugin thread, it re-posts when ready
+                atomic_store(&menu_show_pending, true);
+                mp_dispatch_enqueue(ctx->dispatch, menu_build_fn, ctx);
+                mpv_wakeup(ctx->mpv);
+                break;
+            }
+            if (GetCursorPos(&pt)) {
+                atomic_store(&menu_shown, true);
+                show_menu(ctx, &pt);
+                atomic_store(&menu_shown, false);
+                if (atomic_exchange(&reload_pending, false))
+                    menu_reload_queue();
+            }
+            break;
+        case WM_INITMENUPOPUP:
+            handle_init_menu(ctx, (HMENU)wParam);
             break;
         case WM_COMMAND:
             handle_menu(ctx, LOWORD(wParam));
             break;
+        case WM_MEASUREITEM:
+            if (handle_measure_item(ctx, (MEASUREITEMSTRUCT *)lParam))
+                return TRUE;
+            break;
+        case WM_DRAWITEM:
+            if (handle_draw_item(ctx, (DRAWITEMSTRUCT *)lParam)) return TRUE;
+            break;
         default:
             break;
     }
@@ -49,16 +332,41 @@ static void plugin_read_conf(plugin_config *conf, const char *name) {
         if (name.len == 0 || value.len == 0) continue;
 
         if (bstr_equals0(name, "uosc")) conf->uosc = bstr_equals0(value, "yes");
+        if (bstr_equals0(name, "shared"))
+            conf->shared = bstr_equals0(value, "yes");
+        if (bstr_equals0(name, "debounce"))
+            conf->debounce = bstrtoll(value, &value, 10);
+        if (bstr_equals0(name, "paginate"))
+            conf->paginate = bstrtoll(value, &value, 10);
+        if (bstr_equals0(name, "ownerdraw"))
+            conf->ownerdraw = bstr_equals0(value, "yes");
+        if (bstr_equals0(name, "memcap"))
+            conf->memcap = bstrtoll(value, &value, 10);
     }
 
     talloc_free(tmp);
 }
 
 static void plugin_register(int64_t wid) {
-    ctx->hmenu = load_menu(ctx);
     ctx->hwnd = (HWND)wid;
     ctx->wnd_proc =
         (WNDPROC)SetWindowLongPtrW(ctx->hwnd, GWLP_WNDPROC, (LONG_PTR)WndProc);
+    menu_watch_start();
+}
+
+static void dyn_update_fn(void *data) {
+    plugin_ctx *ctx = data;
+    ctx->dyn_queued = false;
+    dyn_menu_update(ctx);
+}
+
+// refresh dynamic menu gray states off the popup hot path, so that
+// show_menu() only has to call TrackPopupMenuEx()
+static void dyn_update_queue() {
+    if (ctx->dyn_queued || ctx->hmenu == NULL) return;
+    ctx->dyn_queued = true;
+    mp_dispatch_enqueue(ctx->dispatch, dyn_update_fn, ctx);
+    mpv_wakeup(ctx->mpv);
 }
 
 static void handle_property_change(mpv_event *event) {
@@ -67,52 +375,129 @@ static void handle_property_change(mpv_event *event) {
         strcmp(prop->name, "window-id") == 0) {
         int64_t wid = *(int64_t *)prop->data;
         if (wid > 0) plugin_register(wid);
-    } else {
+    } else if (!mp_state_mark_dirty(ctx->state, prop->name)) {
+        // the window thread dereferences the state lists under the menu
+        // lock while the popup is up, never swap them unlocked
+        menu_lock();
         mp_state_update(ctx->state, event);
+        menu_unlock();
+        dyn_update_queue();
     }
 }
 
+// startup prefetch reply: only remember the config path here, the
+// build itself stays deferred so cold startup does not pay for it
+static void handle_property_reply(mpv_event *event) {
+    if (event->reply_userdata != REPLY_INPUT_CONF) return;
+
+    mpv_event_property *prop = event->data;
+    if (prop->format == MPV_FORMAT_STRING)
+        ctx->input_conf = talloc_strdup(ctx, *(char **)prop->data);
+    menu_deferred = true;
+}
+
 static void handle_client_message(mpv_event *event) {
     mpv_event_client_message *msg = event->data;
     if (msg->num_args < 1) return;
 
     const char *cmd = msg->args[0];
-    if (strcmp(cmd, "show") == 0) PostMessageW(ctx->hwnd, WM_SHOWMENU, 0, 0);
+    if (strcmp(cmd, "show") == 0) {
+        PostMessageW(ctx->hwnd, WM_SHOWMENU, 0, 0);
+    } else if (strcmp(cmd, "perf") == 0) {
+        perf_publish(ctx->mpv);
+    } else if (strcmp(cmd, "mem") == 0) {
+        mem_publish(ctx);
+    } else if (strcmp(cmd, "batch") == 0) {
+        // submit multiple commands back-to-back, already on the mpv thread
+        // so they bypass the ring entirely
+        for (int i = 1; i < msg->num_args; i++)
+            mpv_command_string(ctx->mpv, msg->args[i]);
+    } else if (strcmp(cmd, "register") == 0 && msg->num_args >= 2) {
+        if (menu_script_register(ctx, msg->args[1])) menu_reload_force();
+    } else if (strcmp(cmd, "items") == 0 && msg->num_args >= 2) {
+        if (menu_script_register(ctx, msg->args[1])) menu_reload_force();
+        menu_script_update(ctx, msg->args[1], (const char **)&msg->args[2],
+                           msg->num_args - 2);
+        dyn_update_queue();
+    }
 }
 
 static plugin_ctx *create_plugin_ctx() {
     plugin_ctx *ctx = talloc_zero(NULL, plugin_ctx);
     ctx->conf = talloc_zero(ctx, plugin_config);
+    ctx->conf->paginate = 100;
     ctx->state = talloc_zero(ctx, mp_state);
     return ctx;
 }
 
 static void destroy_plugin_ctx() {
     if (ctx->hmenu) DestroyMenu(ctx->hmenu);
+    if (ctx->hmenu_old) DestroyMenu(ctx->hmenu_old);
+    if (ctx->hshared) CloseHandle(ctx->hshared);
     if (ctx->hwnd && ctx->wnd_proc)
         SetWindowLongPtrW(ctx->hwnd, GWLP_WNDPROC, (LONG_PTR)ctx->wnd_proc);
     talloc_free(ctx);
 }
 
+// wake the mpv event loop when work is enqueued from another thread
+static void dispatch_wakeup_fn(void *data) {
+    mpv_wakeup((mpv_handle *)data);
+}
+
 MPV_EXPORT int mpv_open_cplugin(mpv_handle *handle) {
     ctx = create_plugin_ctx(NULL);
     ctx->mpv = handle;
     ctx->dispatch = mp_dispatch_create(ctx);
+    mp_dispatch_set_wakeup_fn(ctx->dispatch, dispatch_wakeup_fn, handle);
+    cmd_ring_init();
 
     plugin_read_conf(ctx->conf, mpv_client_name(handle));
     mpv_observe_property(handle, 0, "window-id", MPV_FORMAT_INT64);
-    mp_state_init(ctx->state, handle);
+    mp_state_init(ctx->state, handle, ctx->dispatch);
+
+    // kick off the config load before the window exists, it runs while
+    // the core is still starting up
+    mpv_get_property_async(handle, REPLY_INPUT_CONF, "input-conf",
+                           MPV_FORMAT_STRING);
 
     while (handle) {
-        mpv_event *event = mpv_wait_event(handle, -1);
+        // while coalesced property updates are pending, wait only for the
+        // configured debounce so a quiet queue flushes them
+        double timeout = -1;
+        if (mp_state_pending(ctx->state))
+            timeout = ctx->conf->debounce / 1000.0;
+        // while a menu build is owed, wake up once the loop goes quiet
+        if (menu_deferred && (timeout < 0 || timeout > MENU_BUILD_IDLE))
+            timeout = MENU_BUILD_IDLE;
+        mpv_event *event = mpv_wait_event(handle, timeout);
         if (event->event_id == MPV_EVENT_SHUTDOWN) break;
 
         mp_dispatch_queue_process(ctx->dispatch, 0);
+        cmd_ring_drain(handle);
 
         switch (event->event_id) {
+            case MPV_EVENT_NONE:
+                // event burst drained (or debounce expired): apply each
+                // dirty property at most once
+                if (mp_state_pending(ctx->state)) {
+                    // same locking as mp_state_update(): the flush swaps
+                    // lists the window thread may be reading
+                    menu_lock();
+                    mp_state_flush(ctx->state, handle);
+                    menu_unlock();
+                    dyn_update_queue();
+                }
+                if (menu_deferred) menu_build_fn(ctx);
+                // the draw handlers read their table lockless while the
+                // popup is up, defer compaction until it is dismissed
+                if (!atomic_load(&menu_shown)) mem_check(ctx);
+                break;
             case MPV_EVENT_PROPERTY_CHANGE:
                 handle_property_change(event);
                 break;
+            case MPV_EVENT_GET_PROPERTY_REPLY:
+                handle_property_reply(event);
+                break;
             case MPV_EVENT_CLIENT_MESSAGE:
                 handle_client_message(event);
                 break;
@@ -121,7 +506,9 @@ MPV_EXPORT int mpv_open_cplugin(mpv_handle *handle) {
         }
     }
 
+    menu_watch_stop();
     mpv_unobserve_property(handle, 0);
+    mp_state_destroy(ctx->state);
     destroy_plugin_ctx();
 
     return 0;
@@ -135,6 +522,25 @@ wchar_t *mp_from_utf8(void *talloc_ctx, const char *s) {
     return ret;
 }
 
+char *mp_to_utf8(void *talloc_ctx, const wchar_t *s) {
+    int count = WideCharToMultiByte(CP_UTF8, 0, s, -1, NULL, 0, NULL, NULL);
+    if (count <= 0) abort();
+    char *ret = talloc_array(talloc_ctx, char, count);
+    WideCharToMultiByte(CP_UTF8, 0, s, -1, ret, count, NULL, NULL);
+    return ret;
+}
+
+wchar_t *mp_from_utf8_bstr(void *talloc_ctx, bstr s) {
+    if (s.len == 0) return talloc_zero_array(talloc_ctx, wchar_t, 1);
+    int count =
+        MultiByteToWideChar(CP_UTF8, 0, (char *)s.start, s.len, NULL, 0);
+    if (count <= 0) abort();
+    wchar_t *ret = talloc_array(talloc_ctx, wchar_t, count + 1);
+    MultiByteToWideChar(CP_UTF8, 0, (char *)s.start, s.len, ret, count);
+    ret[count] = L'\0';
+    return ret;
+}
+
 char *mp_get_prop_string(void *talloc_ctx, const char *prop) {
     char *val = mpv_get_property_string(ctx->mpv, prop);
     char *ret = talloc_strdup(talloc_ctx, val);
@@ -154,11 +560,19 @@ char *mp_expand_path(void *talloc_ctx, char *path) {
 
 static void async_cmd_fn(void *data) {
     mpv_command_string(ctx->mpv, (const char *)data);
+    talloc_free(data);
 }
 
 void mp_command_async(const char *args) {
-    mp_dispatch_enqueue(ctx->dispatch, async_cmd_fn, (void *)args);
-    mpv_wakeup(ctx->mpv);
+    // copy the string: the caller's buffer belongs to the current menu
+    // generation, which a reload can free before the ring drains
+    char *cmd = talloc_strdup(NULL, args);
+
+    // fall back to the dispatch queue if the ring is full
+    if (!cmd_ring_push(cmd, true)) {
+        mp_dispatch_enqueue(ctx->dispatch, async_cmd_fn, cmd);
+        mpv_wakeup(ctx->mpv);
+    }
 }
 
 char *mp_read_file(void *talloc_ctx, char *path) {
@@ -183,3 +597,45 @@ char *mp_read_file(void *talloc_ctx, char *path) {
 
     return ret;
 }
+
+// map a file read-only, avoiding the buffer copy of mp_read_file,
+// memory:// pseudo paths are handled transparently
+bool mp_map_file(mp_file_map *map, void *talloc_ctx, char *path) {
+    *map = (mp_file_map){.hfile = INVALID_HANDLE_VALUE};
+
+    if (bstr_startswith0(bstr0(path), "memory://")) {
+        map->data =
+            bstr0(talloc_strdup(talloc_ctx, path + strlen("memory://")));
+        return true;
+    }
+
+    void *tmp = talloc_new(NULL);
+    wchar_t *path_w = mp_from_utf8(tmp, mp_expand_path(tmp, path));
+    map->hfile = CreateFileW(path_w, GENERIC_READ, FILE_SHARE_READ, NULL,
+                             OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    talloc_free(tmp);
+    if (map->hfile == INVALID_HANDLE_VALUE) return false;
+
+    DWORD dwFileSize = GetFileSize(map->hfile, NULL);
+    if (dwFileSize == 0) return true;  // empty file, empty view
+
+    map->hmap = CreateFileMappingW(map->hfile, NULL, PAGE_READONLY, 0, 0,
+                                   NULL);
+    if (map->hmap != NULL) {
+        map->view = MapViewOfFile(map->hmap, FILE_MAP_READ, 0, 0, 0);
+        if (map->view != NULL) {
+            map->data = (bstr){map->view, dwFileSize};
+            return true;
+        }
+    }
+
+    mp_unmap_file(map);
+    return false;
+}
+
+void mp_unmap_file(mp_file_map *map) {
+    if (map->view != NULL) UnmapViewOfFile(map->view);
+    if (map->hmap != NULL) CloseHandle(map->hmap);
+    if (map->hfile != INVALID_HANDLE_VALUE) CloseHandle(map->hfile);
+    *map = (mp_file_map){.hfile = INVALID_HANDLE_VALUE};
+}
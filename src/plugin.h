@@ -6,11 +6,17 @@
 
 #include <windows.h>
 #include <mpv/client.h>
+#include "misc/bstr.h"
 #include "misc/dispatch.h"
 #include "types.h"
 
 typedef struct {
-    bool uosc;  // use uosc menu syntax
+    bool uosc;       // use uosc menu syntax
+    bool shared;     // share the compiled menu across instances
+    int debounce;    // property update debounce in milliseconds
+    int paginate;    // split dynamic submenus above this many items, 0 = off
+    bool ownerdraw;  // owner-drawn menu items, DPI aware per monitor
+    int memcap;      // compact when the heap exceeds this many MiB, 0 = off
 } plugin_config;
 
 typedef struct {
@@ -20,15 +26,34 @@ typedef struct {
     mpv_handle *mpv;  // mpv client handle
     mp_state *state;  // cached mpv properties
 
+    char *input_conf;  // prefetched at startup, NULL until the reply lands
+
     HWND hwnd;         // window handle
     HMENU hmenu;       // menu handle
+    HMENU hmenu_old;   // previous menu, kept alive one reload generation
     WNDPROC wnd_proc;  // previous window procedure
+
+    bool dyn_queued;  // dynamic menu rebuild queued on the dispatch queue
+
+    HANDLE hshared;  // published shared menu section, NULL if none
 } plugin_ctx;
 
+// read-only view of a memory-mapped file
+typedef struct {
+    bstr data;     // file content view
+    HANDLE hfile;  // file handle, INVALID_HANDLE_VALUE if not mapped
+    HANDLE hmap;   // file mapping handle
+    void *view;    // mapped view address
+} mp_file_map;
+
 wchar_t *mp_from_utf8(void *talloc_ctx, const char *s);
+char *mp_to_utf8(void *talloc_ctx, const wchar_t *s);
+wchar_t *mp_from_utf8_bstr(void *talloc_ctx, bstr s);
 char *mp_get_prop_string(void *talloc_ctx, const char *prop);
 char *mp_expand_path(void *talloc_ctx, char *path);
 char *mp_read_file(void *talloc_ctx, char *path);
+bool mp_map_file(mp_file_map *map, void *talloc_ctx, char *path);
+void mp_unmap_file(mp_file_map *map);
 void mp_command_async(const char *args);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,51 @@
+// Copyright (c) 2023 tsl0922. All rights reserved.
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <emmintrin.h>
+#include <immintrin.h>
+
+#include "scan.h"
+
+// byte-wise scanning dominates the load of large configs; these scanners
+// walk the buffer in SIMD strides instead: SSE2 is the x86-64 baseline,
+// the AVX2 variant is picked at runtime when the CPU supports it
+
+static size_t scan_newline_sse2(const unsigned char *p, size_t len) {
+    size_t i = 0;
+    __m128i nl = _mm_set1_epi8('\n');
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+    for (; i < len; i++) {
+        if (p[i] == '\n') return i;
+    }
+    return len;
+}
+
+__attribute__((target("avx2"))) static size_t scan_newline_avx2(
+    const unsigned char *p, size_t len) {
+    size_t i = 0;
+    __m256i nl = _mm256_set1_epi8('\n');
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+    return i + scan_newline_sse2(p + i, len - i);
+}
+
+static size_t (*scan_newline)(const unsigned char *p, size_t len) = NULL;
+
+bstr mp_scan_getline(bstr str, bstr *rest) {
+    if (scan_newline == NULL) {
+        scan_newline = __builtin_cpu_supports("avx2") ? scan_newline_avx2
+                                                      : scan_newline_sse2;
+    }
+
+    size_t pos = str.len > 0 ? scan_newline(str.start, str.len) : 0;
+    if (pos < str.len) pos++;  // the line includes its '\n'
+    if (rest != NULL) *rest = (bstr){str.start + pos, str.len - pos};
+    return (bstr){str.start, pos};
+}
@@ -0,0 +1,13 @@
+// Copyright (c) 2023 tsl0922. All rights reserved.
+// SPDX-License-Identifier: GPL-2.0-only
+
+#ifndef MPV_PLUGIN_SCAN_H
+#define MPV_PLUGIN_SCAN_H
+
+#include "misc/bstr.h"
+
+// vectorized drop-in for bstr_getline(): finds the next line break in
+// 16/32 byte strides, the returned line includes the trailing '\n'
+bstr mp_scan_getline(bstr str, bstr *rest);
+
+#endif
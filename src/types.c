@@ -1,16 +1,199 @@
 // Copyright (c) 2023 tsl0922. All rights reserved.
 // SPDX-License-Identifier: GPL-2.0-only
 
+#include <stdlib.h>
+
 #include <mpv/client.h>
 #include "mpv_talloc.h"
 #include "misc/ctype.h"
+#include "misc/dispatch.h"
+#include "osdep/threads.h"
+#include "plugin.h"
 #include "types.h"
 
+// interned string pool: an open-addressing hash of refcounted strings, so
+// list rebuilds reuse existing allocations for the strings that repeat
+// between rebuilds (track types, language codes, device names, titles)
+struct intern_slot {
+    char *str;      // interned string, owned by the pool
+    uint32_t refs;  // reference count
+};
+
+struct mp_intern_pool {
+    struct intern_slot *slots;
+    int size;  // allocated size, power of two
+    int used;
+};
+
+static uint64_t intern_hash(const char *s) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *s; s++) h = (h ^ (unsigned char)*s) * 0x100000001b3ULL;
+    return h;
+}
+
+static struct intern_slot *intern_slot_find(struct mp_intern_pool *pool,
+                                            const char *s) {
+    int mask = pool->size - 1;
+    for (int i = intern_hash(s) & mask;; i = (i + 1) & mask) {
+        struct intern_slot *slot = &pool->slots[i];
+        if (slot->str == NULL || strcmp(slot->str, s) == 0) return slot;
+    }
+}
+
+static struct mp_intern_pool *intern_pool(mp_state *state) {
+    if (state->intern == NULL) {
+        state->intern = talloc_zero(state, struct mp_intern_pool);
+        state->intern->size = 256;
+        state->intern->slots = talloc_zero_array(
+            state->intern, struct intern_slot, state->intern->size);
+    }
+    return state->intern;
+}
+
+char *mp_intern(mp_state *state, const char *s) {
+    if (s == NULL) return NULL;
+    struct mp_intern_pool *pool = intern_pool(state);
+
+    if (pool->used * 4 >= pool->size * 3) {
+        struct intern_slot *old = pool->slots;
+        int old_size = pool->size;
+        pool->size *= 2;
+        pool->slots =
+            talloc_zero_array(pool, struct intern_slot, pool->size);
+        for (int i = 0; i < old_size; i++) {
+            if (old[i].str == NULL) continue;
+            *intern_slot_find(pool, old[i].str) = old[i];
+        }
+        talloc_free(old);
+    }
+
+    struct intern_slot *slot = intern_slot_find(pool, s);
+    if (slot->str == NULL) {
+        slot->str = talloc_strdup(pool, s);
+        pool->used++;
+    }
+    slot->refs++;
+    return slot->str;
+}
+
+// look up an interned string without taking a reference
+char *mp_intern_get(mp_state *state, const char *s) {
+    if (s == NULL || state->intern == NULL) return NULL;
+    return intern_slot_find(state->intern, s)->str;
+}
+
+// drop a reference; unreferenced strings stay in the pool so an identical
+// rebuild reuses the allocation, they are only swept on compaction
+void mp_intern_release(mp_state *state, char *s) {
+    if (s == NULL || state->intern == NULL) return;
+    struct intern_slot *slot = intern_slot_find(state->intern, s);
+    if (slot->str == s && slot->refs > 0) slot->refs--;
+}
+
+// trim the geometric append slack of a finished list array in place
+static void trim_array(void **arr, size_t elem_size, int num) {
+    if (*arr == NULL) return;
+    size_t want = elem_size * (size_t)num;
+    if (talloc_get_size(*arr) > want)
+        *arr = talloc_realloc_size(NULL, *arr, want);
+}
+
+// reclaim what a long-running instance accumulates but no longer needs:
+// the append slack of the cached lists and the interned strings whose
+// references all went away; called by the memory cap (mem.c), never on
+// a hot path
+void mp_state_compact(mp_state *state) {
+    if (state->track_list != NULL) {
+        trim_array((void **)&state->track_list->entries,
+                   sizeof(mp_track_item), state->track_list->num_entries);
+    }
+    if (state->chapter_list != NULL) {
+        trim_array((void **)&state->chapter_list->entries,
+                   sizeof(mp_chapter_item), state->chapter_list->num_entries);
+    }
+    if (state->edition_list != NULL) {
+        trim_array((void **)&state->edition_list->entries,
+                   sizeof(mp_edition_item), state->edition_list->num_entries);
+    }
+    if (state->audio_device_list != NULL) {
+        trim_array((void **)&state->audio_device_list->entries,
+                   sizeof(mp_audio_device),
+                   state->audio_device_list->num_entries);
+    }
+    if (state->playlist != NULL) {
+        trim_array((void **)&state->playlist->entries,
+                   sizeof(mp_playlist_item), state->playlist->num_entries);
+    }
+    if (state->file_list != NULL) {
+        trim_array((void **)&state->file_list->entries, sizeof(bstr),
+                   state->file_list->num_entries);
+    }
+
+    // sweep unreferenced strings out of the intern pool; open addressing
+    // cannot delete in place, so the live slots move to a fresh table
+    struct mp_intern_pool *pool = state->intern;
+    if (pool == NULL) return;
+
+    int live = 0;
+    for (int i = 0; i < pool->size; i++) {
+        if (pool->slots[i].str != NULL && pool->slots[i].refs > 0) live++;
+    }
+
+    struct intern_slot *old = pool->slots;
+    int old_size = pool->size;
+    pool->size = 256;
+    while (live * 4 >= pool->size * 3) pool->size *= 2;
+    pool->slots = talloc_zero_array(pool, struct intern_slot, pool->size);
+    pool->used = live;
+
+    for (int i = 0; i < old_size; i++) {
+        if (old[i].str == NULL) continue;
+        if (old[i].refs == 0) {
+            talloc_free(old[i].str);
+            continue;
+        }
+        *intern_slot_find(pool, old[i].str) = old[i];
+    }
+    talloc_free(old);
+}
+
+// copy a string into a list's flat buffer and return a view of it
+static bstr flat_append(char *buf, size_t *off, const char *s) {
+    size_t len = strlen(s);
+    memcpy(buf + *off, s, len);
+    bstr ret = {(unsigned char *)buf + *off, len};
+    *off += len;
+    return ret;
+}
+
+static void free_track_list(mp_state *state) {
+    mp_track_list *list = state->track_list;
+    if (list == NULL) return;
+
+    for (int i = 0; i < list->num_entries; i++)
+        mp_intern_release(state, list->entries[i].type);
+    talloc_free(list);
+    state->track_list = NULL;
+}
+
 static void update_track_list(mp_state *state, mpv_node *node) {
-    if (state->track_list != NULL) talloc_free(state->track_list);
+    free_track_list(state);
     state->track_list = talloc_zero(state, mp_track_list);
     mp_track_list *list = state->track_list;
 
+    // sizing pass: one flat buffer holds all copied string payload
+    size_t size = 0;
+    for (int i = 0; i < node->u.list->num; i++) {
+        mpv_node track = node->u.list->values[i];
+        for (int j = 0; j < track.u.list->num; j++) {
+            char *key = track.u.list->keys[j];
+            if (strcmp(key, "title") == 0 || strcmp(key, "lang") == 0)
+                size += strlen(track.u.list->values[j].u.string);
+        }
+    }
+    list->strings = talloc_size(list, size);
+    size_t off = 0;
+
     for (int i = 0; i < node->u.list->num; i++) {
         mpv_node track = node->u.list->values[i];
 
@@ -22,35 +205,95 @@ static void update_track_list(mp_state *state, mpv_node *node) {
             if (strcmp(key, "id") == 0) {
                 item.id = value.u.int64;
             } else if (strcmp(key, "title") == 0) {
-                item.title = talloc_strdup(list, value.u.string);
+                item.title = flat_append(list->strings, &off, value.u.string);
             } else if (strcmp(key, "lang") == 0) {
-                item.lang = talloc_strdup(list, value.u.string);
+                item.lang = flat_append(list->strings, &off, value.u.string);
             } else if (strcmp(key, "type") == 0) {
-                item.type = talloc_strdup(list, value.u.string);
+                item.type = mp_intern(state, value.u.string);
             } else if (strcmp(key, "selected") == 0) {
                 item.selected = value.u.flag;
             }
         }
 
         // set default title if not set
-        if (item.title == NULL)
-            item.title = talloc_asprintf(list, "%s %d", item.type, item.id);
+        if (item.title.len == 0)
+            item.title =
+                bstr0(talloc_asprintf(list, "%s %d", item.type, item.id));
 
-        // convert lang to uppercase
-        if (item.lang != NULL) {
-            for (int x = 0; item.lang[x]; x++)
-                item.lang[x] = mp_toupper(item.lang[x]);
-        }
+        // convert lang to uppercase, in place in the flat buffer
+        for (size_t x = 0; x < item.lang.len; x++)
+            item.lang.start[x] = mp_toupper(item.lang.start[x]);
 
         MP_TARRAY_APPEND(list, list->entries, list->num_entries, item);
     }
 }
 
-static void update_chapter_list(mp_state *state, mpv_node *node) {
+// diff the incoming node against the current list, tracks keyed by
+// id + type: when the set of tracks is unchanged only the selected flags
+// are patched in place, so a track switch bumps the cheap select
+// generation instead of forcing a full list + menu rebuild
+static bool patch_track_list(mp_state *state, mpv_node *node) {
+    mp_track_list *list = state->track_list;
+    if (list == NULL || list->num_entries != node->u.list->num) return false;
+
+    bool selection_changed = false;
+
+    for (int i = 0; i < node->u.list->num; i++) {
+        mpv_node track = node->u.list->values[i];
+        mp_track_item *entry = &list->entries[i];
+
+        int64_t id = 0;
+        char *type = NULL;
+        bool selected = false;
+        for (int j = 0; j < track.u.list->num; j++) {
+            char *key = track.u.list->keys[j];
+            mpv_node value = track.u.list->values[j];
+            if (strcmp(key, "id") == 0) {
+                id = value.u.int64;
+            } else if (strcmp(key, "type") == 0) {
+                type = value.u.string;
+            } else if (strcmp(key, "selected") == 0) {
+                selected = value.u.flag;
+            }
+        }
+
+        // any structural difference falls back to a rebuild
+        if (entry->id != id || entry->type == NULL || type == NULL ||
+            strcmp(entry->type, type) != 0)
+            return false;
+
+        if (entry->selected != selected) {
+            entry->selected = selected;
+            selection_changed = true;
+        }
+    }
+
+    if (selection_changed) state->track_gen.select++;
+    return true;
+}
+
+static void free_chapter_list(mp_state *state) {
     if (state->chapter_list != NULL) talloc_free(state->chapter_list);
+    state->chapter_list = NULL;
+}
+
+static void update_chapter_list(mp_state *state, mpv_node *node) {
+    free_chapter_list(state);
     state->chapter_list = talloc_zero(state, mp_chapter_list);
     mp_chapter_list *list = state->chapter_list;
 
+    // sizing pass: one flat buffer holds all copied string payload
+    size_t size = 0;
+    for (int i = 0; i < node->u.list->num; i++) {
+        mpv_node chapter = node->u.list->values[i];
+        for (int j = 0; j < chapter.u.list->num; j++) {
+            if (strcmp(chapter.u.list->keys[j], "title") == 0)
+                size += strlen(chapter.u.list->values[j].u.string);
+        }
+    }
+    list->strings = talloc_size(list, size);
+    size_t off = 0;
+
     for (int i = 0; i < node->u.list->num; i++) {
         mpv_node chapter = node->u.list->values[i];
 
@@ -60,25 +303,71 @@ static void update_chapter_list(mp_state *state, mpv_node *node) {
             char *key = chapter.u.list->keys[j];
             mpv_node value = chapter.u.list->values[j];
             if (strcmp(key, "title") == 0) {
-                item.title = talloc_strdup(list, value.u.string);
+                item.title = flat_append(list->strings, &off, value.u.string);
             } else if (strcmp(key, "time") == 0) {
                 item.time = value.u.double_;
             }
         }
 
         // set default title if not set
-        if (item.title == NULL)
-            item.title = talloc_asprintf(list, "chapter %d", i + 1);
+        if (item.title.len == 0)
+            item.title = bstr0(talloc_asprintf(list, "chapter %d", i + 1));
 
         MP_TARRAY_APPEND(list, list->entries, list->num_entries, item);
     }
 }
 
-static void update_edition_list(mp_state *state, mpv_node *node) {
+// chapters are keyed by index and immutable within a file: when the
+// incoming list is identical the rebuild is skipped entirely
+static bool patch_chapter_list(mp_state *state, mpv_node *node) {
+    mp_chapter_list *list = state->chapter_list;
+    if (list == NULL || list->num_entries != node->u.list->num) return false;
+
+    for (int i = 0; i < node->u.list->num; i++) {
+        mpv_node chapter = node->u.list->values[i];
+        mp_chapter_item *entry = &list->entries[i];
+
+        char *title = NULL;
+        double time = 0;
+        for (int j = 0; j < chapter.u.list->num; j++) {
+            char *key = chapter.u.list->keys[j];
+            mpv_node value = chapter.u.list->values[j];
+            if (strcmp(key, "title") == 0) {
+                title = value.u.string;
+            } else if (strcmp(key, "time") == 0) {
+                time = value.u.double_;
+            }
+        }
+
+        if (entry->time != time) return false;
+        if (title != NULL && !bstr_equals0(entry->title, title)) return false;
+    }
+
+    return true;
+}
+
+static void free_edition_list(mp_state *state) {
     if (state->edition_list != NULL) talloc_free(state->edition_list);
+    state->edition_list = NULL;
+}
+
+static void update_edition_list(mp_state *state, mpv_node *node) {
+    free_edition_list(state);
     state->edition_list = talloc_zero(state, mp_edition_list);
     mp_edition_list *list = state->edition_list;
 
+    // sizing pass: one flat buffer holds all copied string payload
+    size_t size = 0;
+    for (int i = 0; i < node->u.list->num; i++) {
+        mpv_node edition = node->u.list->values[i];
+        for (int j = 0; j < edition.u.list->num; j++) {
+            if (strcmp(edition.u.list->keys[j], "title") == 0)
+                size += strlen(edition.u.list->values[j].u.string);
+        }
+    }
+    list->strings = talloc_size(list, size);
+    size_t off = 0;
+
     for (int i = 0; i < node->u.list->num; i++) {
         mpv_node edition = node->u.list->values[i];
 
@@ -88,25 +377,47 @@ static void update_edition_list(mp_state *state, mpv_node *node) {
             char *key = edition.u.list->keys[j];
             mpv_node value = edition.u.list->values[j];
             if (strcmp(key, "title") == 0) {
-                item.title = talloc_strdup(list, value.u.string);
+                item.title = flat_append(list->strings, &off, value.u.string);
             } else if (strcmp(key, "id") == 0) {
                 item.id = value.u.int64;
             }
         }
 
         // set default title if not set
-        if (item.title == NULL)
-            item.title = talloc_asprintf(list, "edition %d", item.id);
+        if (item.title.len == 0)
+            item.title = bstr0(talloc_asprintf(list, "edition %d", item.id));
 
         MP_TARRAY_APPEND(list, list->entries, list->num_entries, item);
     }
 }
 
+static void free_audio_device_list(mp_state *state) {
+    mp_audio_device_list *list = state->audio_device_list;
+    if (list == NULL) return;
+
+    for (int i = 0; i < list->num_entries; i++)
+        mp_intern_release(state, list->entries[i].name);
+    talloc_free(list);
+    state->audio_device_list = NULL;
+}
+
 static void update_audio_device_list(mp_state *state, mpv_node *node) {
-    if (state->audio_device_list != NULL) talloc_free(state->audio_device_list);
+    free_audio_device_list(state);
     state->audio_device_list = talloc_zero(state, mp_audio_device_list);
     mp_audio_device_list *list = state->audio_device_list;
 
+    // sizing pass: one flat buffer holds all copied string payload
+    size_t size = 0;
+    for (int i = 0; i < node->u.list->num; i++) {
+        mpv_node device = node->u.list->values[i];
+        for (int j = 0; j < device.u.list->num; j++) {
+            if (strcmp(device.u.list->keys[j], "description") == 0)
+                size += strlen(device.u.list->values[j].u.string);
+        }
+    }
+    list->strings = talloc_size(list, size);
+    size_t off = 0;
+
     for (int i = 0; i < node->u.list->num; i++) {
         mpv_node device = node->u.list->values[i];
 
@@ -116,9 +427,9 @@ static void update_audio_device_list(mp_state *state, mpv_node *node) {
             char *key = device.u.list->keys[j];
             mpv_node value = device.u.list->values[j];
             if (strcmp(key, "name") == 0) {
-                item.name = talloc_strdup(list, value.u.string);
+                item.name = mp_intern(state, value.u.string);
             } else if (strcmp(key, "description") == 0) {
-                item.desc = talloc_strdup(list, value.u.string);
+                item.desc = flat_append(list->strings, &off, value.u.string);
             }
         }
 
@@ -126,67 +437,348 @@ static void update_audio_device_list(mp_state *state, mpv_node *node) {
     }
 }
 
-void mp_state_init(mp_state *state, mpv_handle *mpv) {
-    mpv_observe_property(mpv, 0, "vid", MPV_FORMAT_INT64);
-    mpv_observe_property(mpv, 0, "aid", MPV_FORMAT_INT64);
-    mpv_observe_property(mpv, 0, "sid", MPV_FORMAT_INT64);
-    mpv_observe_property(mpv, 0, "secondary-sid", MPV_FORMAT_INT64);
-    mpv_observe_property(mpv, 0, "chapter", MPV_FORMAT_INT64);
-    mpv_observe_property(mpv, 0, "current-edition", MPV_FORMAT_INT64);
-    mpv_observe_property(mpv, 0, "audio-device", MPV_FORMAT_STRING);
-    mpv_observe_property(mpv, 0, "track-list", MPV_FORMAT_NODE);
-    mpv_observe_property(mpv, 0, "chapter-list", MPV_FORMAT_NODE);
-    mpv_observe_property(mpv, 0, "edition-list", MPV_FORMAT_NODE);
-    mpv_observe_property(mpv, 0, "audio-device-list", MPV_FORMAT_NODE);
+static void free_playlist_list(mp_state *state) {
+    if (state->playlist != NULL) talloc_free(state->playlist);
+    state->playlist = NULL;
 }
 
-void mp_state_update(mp_state *state, mpv_event *event) {
-    mpv_event_property *prop = event->data;
-    switch (prop->format) {
+static void update_playlist_list(mp_state *state, mpv_node *node) {
+    free_playlist_list(state);
+    state->playlist = talloc_zero(state, mp_playlist_list);
+    mp_playlist_list *list = state->playlist;
+
+    // sizing pass: one flat buffer holds all copied string payload
+    size_t size = 0;
+    for (int i = 0; i < node->u.list->num; i++) {
+        mpv_node entry = node->u.list->values[i];
+        for (int j = 0; j < entry.u.list->num; j++) {
+            char *key = entry.u.list->keys[j];
+            if (strcmp(key, "title") == 0 || strcmp(key, "filename") == 0)
+                size += strlen(entry.u.list->values[j].u.string);
+        }
+    }
+    list->strings = talloc_size(list, size);
+    size_t off = 0;
+
+    for (int i = 0; i < node->u.list->num; i++) {
+        mpv_node entry = node->u.list->values[i];
+
+        mp_playlist_item item = {0};
+
+        for (int j = 0; j < entry.u.list->num; j++) {
+            char *key = entry.u.list->keys[j];
+            mpv_node value = entry.u.list->values[j];
+            if (strcmp(key, "title") == 0) {
+                item.title = flat_append(list->strings, &off, value.u.string);
+            } else if (strcmp(key, "filename") == 0) {
+                item.filename =
+                    flat_append(list->strings, &off, value.u.string);
+            }
+        }
+
+        // default to the filename tail if no title is set
+        if (item.title.len == 0) {
+            item.title = item.filename;
+            int cut = bstrrchr(item.title, '/');
+            int cut2 = bstrrchr(item.title, '\\');
+            if (cut2 > cut) cut = cut2;
+            if (cut >= 0) item.title = bstr_cut(item.title, cut + 1);
+        }
+
+        MP_TARRAY_APPEND(list, list->entries, list->num_entries, item);
+    }
+}
+
+// asynchronous sibling-file scan, published through the dispatch queue so
+// the state is only ever touched on the mpv thread
+typedef struct {
+    mp_state *state;     // owning state, not touched by the scan thread
+    uint32_t id;         // scan generation, stale results are dropped
+    char *path;          // playing file path
+    mp_file_list *list;  // scan result, detached until published
+} mp_file_scan;
+
+static void file_scan_publish(void *ptr) {
+    mp_file_scan *scan = ptr;
+    mp_state *state = scan->state;
+
+    state->scans_inflight--;
+    if (scan->id == state->scan_id && scan->list != NULL) {
+        if (state->file_list != NULL) talloc_free(state->file_list);
+        state->file_list = talloc_steal(state, scan->list);
+        state->playlist_gen.list++;
+    }
+    talloc_free(scan);
+}
+
+static int file_name_cmp(const void *a, const void *b) {
+    return bstrcmp(*(const bstr *)a, *(const bstr *)b);
+}
+
+static MP_THREAD_VOID file_scan_thread(void *ptr) {
+    mp_file_scan *scan = ptr;
+    mp_file_list *list = talloc_zero(scan, mp_file_list);
+
+    char *sep = strrchr(scan->path, '/');
+    char *sep2 = strrchr(scan->path, '\\');
+    if (sep2 > sep) sep = sep2;
+    if (sep != NULL) {
+        list->dir = talloc_strndup(list, scan->path, sep - scan->path);
+        char *pattern = talloc_asprintf(scan, "%s/*", list->dir);
+
+        bstr flat = {0};
+        size_t *offs = NULL;
+        int num_offs = 0;
+
+        WIN32_FIND_DATAW fd;
+        HANDLE hFind = FindFirstFileW(mp_from_utf8(scan, pattern), &fd);
+        if (hFind != INVALID_HANDLE_VALUE) {
+            do {
+                if (fd.dwFileAttributes &
+                    (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_HIDDEN))
+                    continue;
+                MP_TARRAY_APPEND(scan, offs, num_offs, flat.len);
+                bstr_xappend(list, &flat,
+                             bstr0(mp_to_utf8(scan, fd.cFileName)));
+            } while (FindNextFileW(hFind, &fd));
+            FindClose(hFind);
+        }
+
+        list->strings = (char *)flat.start;
+        list->entries = talloc_array(list, bstr, num_offs);
+        list->num_entries = num_offs;
+        for (int i = 0; i < num_offs; i++) {
+            size_t end = i + 1 < num_offs ? offs[i + 1] : flat.len;
+            list->entries[i] = (bstr){
+                (unsigned char *)list->strings + offs[i], end - offs[i]};
+        }
+
+        // directory listing order is not defined, sort for a stable menu
+        qsort(list->entries, list->num_entries, sizeof(bstr), file_name_cmp);
+    }
+
+    scan->list = list;
+    mp_dispatch_enqueue(scan->state->dispatch, file_scan_publish, scan);
+    MP_THREAD_RETURN();
+}
+
+// kick off a sibling-file scan of the playing file's directory on a worker
+// thread, so the popup hot path never touches the file system
+static void file_scan_start(mp_state *state, const char *path) {
+    state->scan_id++;
+
+    // drop the sibling list when nothing (or a non-file source) is playing
+    if (path == NULL || path[0] == '\0' || strstr(path, "://") != NULL) {
+        if (state->file_list != NULL) {
+            talloc_free(state->file_list);
+            state->file_list = NULL;
+            state->playlist_gen.list++;
+        }
+        return;
+    }
+
+    mp_file_scan *scan = talloc_zero(NULL, mp_file_scan);
+    scan->state = state;
+    scan->id = state->scan_id;
+    scan->path = talloc_strdup(scan, path);
+
+    mp_thread thread;
+    if (mp_thread_create(&thread, file_scan_thread, scan) == 0) {
+        mp_thread_detach(thread);
+        state->scans_inflight++;
+    } else {
+        talloc_free(scan);
+    }
+}
+
+#define MP_ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+// properties mirrored into mp_state
+static const struct {
+    const char *name;
+    mpv_format format;
+} observed_props[] = {
+    {"vid", MPV_FORMAT_INT64},
+    {"aid", MPV_FORMAT_INT64},
+    {"sid", MPV_FORMAT_INT64},
+    {"secondary-sid", MPV_FORMAT_INT64},
+    {"chapter", MPV_FORMAT_INT64},
+    {"current-edition", MPV_FORMAT_INT64},
+    {"playlist-pos", MPV_FORMAT_INT64},
+    {"audio-device", MPV_FORMAT_STRING},
+    {"path", MPV_FORMAT_STRING},
+    {"track-list", MPV_FORMAT_NODE},
+    {"chapter-list", MPV_FORMAT_NODE},
+    {"edition-list", MPV_FORMAT_NODE},
+    {"audio-device-list", MPV_FORMAT_NODE},
+    {"playlist", MPV_FORMAT_NODE},
+};
+
+void mp_state_init(mp_state *state, mpv_handle *mpv,
+                   struct mp_dispatch_queue *dispatch) {
+    state->dispatch = dispatch;
+    for (int i = 0; i < MP_ARRAY_SIZE(observed_props); i++) {
+        mpv_observe_property(mpv, 0, observed_props[i].name,
+                             observed_props[i].format);
+    }
+}
+
+// wait for in-flight file scans, so their publish callbacks cannot outlive
+// the dispatch queue they are enqueued on
+void mp_state_destroy(mp_state *state) {
+    state->scan_id++;  // drop pending results
+    while (state->scans_inflight > 0)
+        mp_dispatch_queue_process(state->dispatch, 1);
+}
+
+static void mp_state_apply(mp_state *state, const char *name,
+                           mpv_format format, void *data) {
+    switch (format) {
         case MPV_FORMAT_NONE:
-            if (strcmp(prop->name, "vid") == 0) {
+            if (strcmp(name, "vid") == 0) {
                 state->vid = -1;
-            } else if (strcmp(prop->name, "aid") == 0) {
+                state->track_gen.select++;
+            } else if (strcmp(name, "aid") == 0) {
                 state->aid = -1;
-            } else if (strcmp(prop->name, "sid") == 0) {
+                state->track_gen.select++;
+            } else if (strcmp(name, "sid") == 0) {
                 state->sid = -1;
-            } else if (strcmp(prop->name, "secondary-sid") == 0) {
+                state->track_gen.select++;
+            } else if (strcmp(name, "secondary-sid") == 0) {
                 state->sid2 = -1;
+                state->track_gen.select++;
+            } else if (strcmp(name, "playlist-pos") == 0) {
+                state->playlist_pos = -1;
+                state->playlist_gen.select++;
+            } else if (strcmp(name, "path") == 0) {
+                file_scan_start(state, NULL);
             }
             break;
         case MPV_FORMAT_INT64:
-            if (strcmp(prop->name, "vid") == 0) {
-                state->vid = *(int64_t *)prop->data;
-            } else if (strcmp(prop->name, "aid") == 0) {
-                state->aid = *(int64_t *)prop->data;
-            } else if (strcmp(prop->name, "sid") == 0) {
-                state->sid = *(int64_t *)prop->data;
-            } else if (strcmp(prop->name, "secondary-sid") == 0) {
-                state->sid2 = *(int64_t *)prop->data;
-            } else if (strcmp(prop->name, "chapter") == 0) {
-                state->chapter = *(int64_t *)prop->data;
-            } else if (strcmp(prop->name, "current-edition") == 0) {
-                state->edition = *(int64_t *)prop->data;
+            if (strcmp(name, "vid") == 0) {
+                state->vid = *(int64_t *)data;
+                state->track_gen.select++;
+            } else if (strcmp(name, "aid") == 0) {
+                state->aid = *(int64_t *)data;
+                state->track_gen.select++;
+            } else if (strcmp(name, "sid") == 0) {
+                state->sid = *(int64_t *)data;
+                state->track_gen.select++;
+            } else if (strcmp(name, "secondary-sid") == 0) {
+                state->sid2 = *(int64_t *)data;
+                state->track_gen.select++;
+            } else if (strcmp(name, "chapter") == 0) {
+                state->chapter = *(int64_t *)data;
+                state->chapter_gen.select++;
+            } else if (strcmp(name, "current-edition") == 0) {
+                state->edition = *(int64_t *)data;
+                state->edition_gen.select++;
+            } else if (strcmp(name, "playlist-pos") == 0) {
+                state->playlist_pos = *(int64_t *)data;
+                state->playlist_gen.select++;
             }
             break;
         case MPV_FORMAT_STRING:
-            if (strcmp(prop->name, "audio-device") == 0) {
+            if (strcmp(name, "audio-device") == 0) {
                 if (state->audio_device != NULL)
                     talloc_free(state->audio_device);
-                char *val = *(char **)prop->data;
+                char *val = *(char **)data;
                 state->audio_device = talloc_strdup(state, val);
+                state->audio_device_gen.select++;
+            } else if (strcmp(name, "path") == 0) {
+                file_scan_start(state, *(char **)data);
             }
             break;
         case MPV_FORMAT_NODE:
-            if (strcmp(prop->name, "track-list") == 0) {
-                update_track_list(state, prop->data);
-            } else if (strcmp(prop->name, "chapter-list") == 0) {
-                update_chapter_list(state, prop->data);
-            } else if (strcmp(prop->name, "edition-list") == 0) {
-                update_edition_list(state, prop->data);
-            } else if (strcmp(prop->name, "audio-device-list") == 0) {
-                update_audio_device_list(state, prop->data);
+            if (strcmp(name, "track-list") == 0) {
+                if (!patch_track_list(state, data)) {
+                    update_track_list(state, data);
+                    state->track_gen.list++;
+                }
+            } else if (strcmp(name, "playlist") == 0) {
+                update_playlist_list(state, data);
+                state->playlist_gen.list++;
+            } else if (strcmp(name, "chapter-list") == 0) {
+                if (!patch_chapter_list(state, data)) {
+                    update_chapter_list(state, data);
+                    state->chapter_gen.list++;
+                }
+            } else if (strcmp(name, "edition-list") == 0) {
+                update_edition_list(state, data);
+                state->edition_gen.list++;
+            } else if (strcmp(name, "audio-device-list") == 0) {
+                update_audio_device_list(state, data);
+                state->audio_device_gen.list++;
+            }
+            break;
+    }
+}
+
+void mp_state_update(mp_state *state, mpv_event *event) {
+    mpv_event_property *prop = event->data;
+    mp_state_apply(state, prop->name, prop->format, prop->data);
+}
+
+// mark an observed property dirty for a later coalesced update,
+// returns false if the property is not mirrored into mp_state
+bool mp_state_mark_dirty(mp_state *state, const char *name) {
+    for (int i = 0; i < MP_ARRAY_SIZE(observed_props); i++) {
+        if (strcmp(observed_props[i].name, name) == 0) {
+            state->dirty |= 1u << i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool mp_state_pending(mp_state *state) {
+    return state->dirty != 0;
+}
+
+// re-fetch a property and apply it to the state
+static void mp_state_refresh(mp_state *state, mpv_handle *mpv,
+                             const char *name, mpv_format format) {
+    switch (format) {
+        case MPV_FORMAT_INT64: {
+            int64_t val;
+            if (mpv_get_property(mpv, name, MPV_FORMAT_INT64, &val) >= 0) {
+                mp_state_apply(state, name, MPV_FORMAT_INT64, &val);
+            } else {
+                mp_state_apply(state, name, MPV_FORMAT_NONE, NULL);
             }
             break;
+        }
+        case MPV_FORMAT_STRING: {
+            char *val = mpv_get_property_string(mpv, name);
+            if (val != NULL) {
+                mp_state_apply(state, name, MPV_FORMAT_STRING, &val);
+                mpv_free(val);
+            } else {
+                mp_state_apply(state, name, MPV_FORMAT_NONE, NULL);
+            }
+            break;
+        }
+        case MPV_FORMAT_NODE: {
+            mpv_node node;
+            if (mpv_get_property(mpv, name, MPV_FORMAT_NODE, &node) >= 0) {
+                mp_state_apply(state, name, MPV_FORMAT_NODE, &node);
+                mpv_free_node_contents(&node);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// apply all dirty properties at most once each
+void mp_state_flush(mp_state *state, mpv_handle *mpv) {
+    uint32_t dirty = state->dirty;
+    state->dirty = 0;
+
+    for (int i = 0; i < MP_ARRAY_SIZE(observed_props); i++) {
+        if (!(dirty & (1u << i))) continue;
+        mp_state_refresh(state, mpv, observed_props[i].name,
+                         observed_props[i].format);
     }
 }
\ No newline at end of file
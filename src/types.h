@@ -5,50 +5,81 @@
 #define MPV_PLUGIN_TYPES_H
 
 #include <mpv/client.h>
+#include "misc/bstr.h"
 
 typedef struct {
     int64_t id;     // the ID as it's used for -sid/--aid/--vid
-    char *type;     // string describing the media type
-    char *title;    // track title as it is stored in the file
-    char *lang;     // track language as identified by the file
+    char *type;     // interned string describing the media type
+    bstr title;     // track title as it is stored in the file
+    bstr lang;      // track language as identified by the file
     bool selected;  // if the track is currently decoded
 } mp_track_item;
 
 typedef struct {
     mp_track_item *entries;
     int num_entries;
+    char *strings;  // flat buffer backing the entry string views
 } mp_track_list;
 
 typedef struct {
-    char *title;  // chapter title as stored in the file
+    bstr title;   // chapter title as stored in the file
     double time;  // chapter start time in seconds as float
 } mp_chapter_item;
 
 typedef struct {
     mp_chapter_item *entries;
     int num_entries;
+    char *strings;  // flat buffer backing the entry string views
 } mp_chapter_list;
 
 typedef struct {
-    char *title;  // edition title as stored in the file
-    int64_t id;   // edition ID as integer
+    bstr title;  // edition title as stored in the file
+    int64_t id;  // edition ID as integer
 } mp_edition_item;
 
 typedef struct {
     mp_edition_item *entries;
     int num_entries;
+    char *strings;  // flat buffer backing the entry string views
 } mp_edition_list;
 
 typedef struct {
-    char *name;  // device name
-    char *desc;  // device description
+    char *name;  // interned device name
+    bstr desc;   // device description
 } mp_audio_device;
 
 typedef struct {
     mp_audio_device *entries;
     int num_entries;
+    char *strings;  // flat buffer backing the entry string views
 } mp_audio_device_list;
 
+typedef struct {
+    bstr title;     // playlist entry title, or the filename tail if untitled
+    bstr filename;  // entry filename as passed to loadfile
+} mp_playlist_item;
+
+typedef struct {
+    mp_playlist_item *entries;
+    int num_entries;
+    char *strings;  // flat buffer backing the entry string views
+} mp_playlist_list;
+
+typedef struct {
+    char *dir;      // scanned directory of the playing file
+    bstr *entries;  // file names, views into the flat buffer
+    int num_entries;
+    char *strings;  // flat buffer backing the entry string views
+} mp_file_list;
+
+typedef struct {
+    uint64_t list;    // bumped when the backing list is rebuilt
+    uint64_t select;  // bumped when only the selection changed
+} mp_state_gen;
+
+struct mp_dispatch_queue;
+struct mp_intern_pool;
+
 typedef struct {
     int64_t vid;      // video ID
     int64_t aid;      // audio ID
@@ -57,15 +88,43 @@ typedef struct {
     int64_t chapter;  // chapter ID
     int64_t edition;  // edition ID
 
+    int64_t playlist_pos;  // current playlist position
+
     char *audio_device;  // audio device name
 
     mp_track_list *track_list;                // track list
     mp_chapter_list *chapter_list;            // chapter list
     mp_edition_list *edition_list;            // edition list
     mp_audio_device_list *audio_device_list;  // audio device list
+    mp_playlist_list *playlist;               // playlist entries
+    mp_file_list *file_list;                  // sibling files, scanned async
+
+    mp_state_gen track_gen;         // track list / selection generation
+    mp_state_gen chapter_gen;       // chapter list / selection generation
+    mp_state_gen edition_gen;       // edition list / selection generation
+    mp_state_gen audio_device_gen;  // audio device list / selection generation
+    mp_state_gen playlist_gen;      // playlist / sibling file generation
+
+    uint32_t dirty;  // bitmask of properties pending a coalesced update
+
+    struct mp_dispatch_queue *dispatch;  // dispatch queue scans publish on
+    uint32_t scan_id;                    // current file scan generation
+    int scans_inflight;                  // file scans not yet published
+
+    struct mp_intern_pool *intern;  // interned string pool
 } mp_state;
 
-void mp_state_init(mp_state *state, mpv_handle *mpv);
+void mp_state_init(mp_state *state, mpv_handle *mpv,
+                   struct mp_dispatch_queue *dispatch);
+void mp_state_destroy(mp_state *state);
 void mp_state_update(mp_state *state, mpv_event *event);
+bool mp_state_mark_dirty(mp_state *state, const char *name);
+bool mp_state_pending(mp_state *state);
+void mp_state_flush(mp_state *state, mpv_handle *mpv);
+void mp_state_compact(mp_state *state);
+
+char *mp_intern(mp_state *state, const char *s);
+char *mp_intern_get(mp_state *state, const char *s);
+void mp_intern_release(mp_state *state, char *s);
 
 #endif
\ No newline at end of file